@@ -2,6 +2,7 @@ import sys
 import os
 import subprocess
 import json
+import tempfile
 from datetime import datetime
 from PIL import Image, ImageFilter, ImageEnhance, ImageOps
 from PIL.ExifTags import TAGS, GPSTAGS
@@ -14,7 +15,7 @@ from PySide6.QtWidgets import (QApplication, QMainWindow, QWidget, QVBoxLayout,
                               QDialog, QCheckBox, QGroupBox, QRadioButton, QProgressBar,
                               QMenu, QStatusBar, QDateEdit)
 from PySide6.QtGui import QPixmap, QImage, QIcon, QAction, QKeySequence, QColor, QPainter, QPen
-from PySide6.QtCore import Qt, QSize, QThread, Signal, QDate, QRect, QBuffer, QByteArray, QPoint
+from PySide6.QtCore import Qt, QSize, QThread, Signal, QDate, QRect, QBuffer, QByteArray, QPoint, QEventLoop
 
 # Path to your C++ executable
 CPP_EXECUTABLE = "./photo_gallery"
@@ -55,6 +56,11 @@ class MetadataExtractor:
                             try:
                                 lat = MetadataExtractor._convert_to_degrees(gps_data['GPSLatitude'])
                                 lon = MetadataExtractor._convert_to_degrees(gps_data['GPSLongitude'])
+                                # South and west are negative in decimal degrees
+                                if str(gps_data.get('GPSLatitudeRef', 'N')).upper().startswith('S'):
+                                    lat = -lat
+                                if str(gps_data.get('GPSLongitudeRef', 'E')).upper().startswith('W'):
+                                    lon = -lon
                                 file_info['location'] = f"{lat:.6f}, {lon:.6f}"
                             except:
                                 pass
@@ -101,28 +107,186 @@ class MetadataExtractor:
 
 class CppBridge:
     """Bridge to the C++ executable"""
+    # Long-lived "photo_gallery serve" process, started on first use so the
+    # database and indexes are loaded once instead of on every call.
+    _server = None
+    _next_request_id = 0
+
+    @staticmethod
+    def _start_server():
+        if CppBridge._server is None or CppBridge._server.poll() is not None:
+            CppBridge._server = subprocess.Popen(
+                [CPP_EXECUTABLE, "serve"],
+                stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                text=True, bufsize=1
+            )
+        return CppBridge._server
+
+    @staticmethod
+    def _run(args):
+        """Run a command, returning (returncode, stdout, stderr)"""
+        try:
+            server = CppBridge._start_server()
+            CppBridge._next_request_id += 1
+            request = {"id": CppBridge._next_request_id, "command": args[0], "args": args[1:]}
+            server.stdin.write(json.dumps(request) + "\n")
+            server.stdin.flush()
+        except Exception as e:
+            print(f"C++ server unavailable, falling back to one-shot call: {e}")
+            CppBridge._server = None
+
+            # Fall back to one process per command; the server never saw this one
+            result = subprocess.run([CPP_EXECUTABLE] + args, capture_output=True, text=True)
+            return result.returncode, result.stdout, result.stderr
+
+        try:
+            line = server.stdout.readline()
+            if line:
+                response = json.loads(line)
+                return response["status"], response["output"], response["error"]
+            error = "C++ server exited before answering"
+        except Exception as e:
+            error = f"C++ server failed before answering: {e}"
+        CppBridge._server = None
+
+        # The server may have applied the command before failing, so running
+        # it again could repeat a write (a second photo, a double view)
+        print(error)
+        return 1, "", error
+
+    @staticmethod
+    def _stream_lines(args):
+        """Run a stream command, yielding its NDJSON lines as they arrive"""
+        server = None
+        try:
+            server = CppBridge._start_server()
+            CppBridge._next_request_id += 1
+            request = {"id": CppBridge._next_request_id, "command": args[0], "args": args[1:]}
+            server.stdin.write(json.dumps(request) + "\n")
+            server.stdin.flush()
+        except Exception as e:
+            print(f"C++ server unavailable, falling back to one-shot call: {e}")
+            CppBridge._server = server = None
+
+        if server is not None:
+            # Records and cursors come first; the response line ends the stream
+            # and must be read even if the caller stops early
+            while True:
+                line = server.stdout.readline()
+                if not line:
+                    CppBridge._server = None
+                    return
+                record = json.loads(line)
+                if "status" in record:
+                    if record["status"] != 0:
+                        print(f"C++ program error: {record['error'].strip()}")
+                    return
+                try:
+                    yield record
+                except GeneratorExit:
+                    CppBridge._drain_response(server)
+                    raise
+
+        # Fall back to one process per command, still read as it is written
+        process = subprocess.Popen([CPP_EXECUTABLE] + args, stdout=subprocess.PIPE, text=True)
+        try:
+            for line in process.stdout:
+                yield json.loads(line)
+        finally:
+            process.stdout.close()
+            process.wait()
+
+    @staticmethod
+    def _drain_response(server):
+        """Skip the rest of an abandoned stream, up to its response line"""
+        for line in server.stdout:
+            if "status" in json.loads(line):
+                return
+
+    @staticmethod
+    def stream_photos(args, after=None, limit=None):
+        """Yield a listing ("get_all_photos", "sort" or "search" and their
+        arguments) as (photos, cursor) chunks while the C++ program writes
+        it. Passing a chunk's cursor as after resumes the listing behind that
+        chunk; the cursor is None once the listing is complete."""
+        options = []
+        if after is not None:
+            options += ["--after", after]
+        if limit is not None:
+            options += ["--limit", str(limit)]
+        photos = []
+        lines = CppBridge._stream_lines(["stream"] + options + args)
+        try:
+            for record in lines:
+                if "cursor" in record:
+                    yield photos, record["cursor"]
+                    photos = []
+                else:
+                    photos.append(record)
+        except Exception as e:
+            print(f"Error calling C++ program: {e}")
+        finally:
+            lines.close()
+
+    @staticmethod
+    def shutdown():
+        """Stop the background server process, if any"""
+        if CppBridge._server is not None and CppBridge._server.poll() is None:
+            try:
+                CppBridge._server.stdin.write(json.dumps({"command": "quit"}) + "\n")
+                CppBridge._server.stdin.flush()
+                CppBridge._server.wait(timeout=5)
+            except Exception:
+                CppBridge._server.kill()
+        CppBridge._server = None
+
     @staticmethod
     def add_photo(filename, location, date_str, description, tags_str, file_size):
         """Add a photo using the C++ program"""
         try:
             cmd = [
-                CPP_EXECUTABLE, "add_photo",
+                "add_photo",
                 filename, location, date_str, description, tags_str, str(file_size)
             ]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            return result.returncode == 0, result.stdout
+            returncode, stdout, _ = CppBridge._run(cmd)
+            return returncode == 0, stdout
         except Exception as e:
             print(f"Error calling C++ program: {e}")
             return False, str(e)
     
     @staticmethod
-    def get_all_photos():
-        """Get all photos from the C++ program"""
+    def import_photos(records):
+        """Add many photos in one transaction via the C++ import command.
+        records are dicts with filename, location, dateTime, description,
+        tags and fileSize. Returns the import report dict, or None on failure."""
+        path = None
+        try:
+            with tempfile.NamedTemporaryFile("w", suffix=".ndjson", delete=False) as f:
+                path = f.name
+                for record in records:
+                    f.write(json.dumps(record) + "\n")
+            returncode, stdout, _ = CppBridge._run(["import", path])
+            if returncode == 0:
+                return json.loads(stdout)
+            return None
+        except Exception as e:
+            print(f"Error calling C++ program: {e}")
+            return None
+        finally:
+            if path is not None:
+                os.remove(path)
+    
+    @staticmethod
+    def get_all_photos(offset=None, limit=None):
+        """Get all photos from the C++ program, or the page of up to limit
+        photos starting at offset"""
         try:
-            cmd = [CPP_EXECUTABLE, "get_all_photos"]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            if result.returncode == 0:
-                return json.loads(result.stdout)
+            cmd = ["get_all_photos"]
+            if offset is not None:
+                cmd += [str(offset)] + ([str(limit)] if limit is not None else [])
+            returncode, stdout, _ = CppBridge._run(cmd)
+            if returncode == 0:
+                return json.loads(stdout)
             return []
         except Exception as e:
             print(f"Error calling C++ program: {e}")
@@ -132,9 +296,8 @@ class CppBridge:
     def view_photo(photo_id):
         """Increment view count for a photo"""
         try:
-            cmd = [CPP_EXECUTABLE, "view_photo", str(photo_id)]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            return result.returncode == 0
+            returncode, _, _ = CppBridge._run(["view_photo", str(photo_id)])
+            return returncode == 0
         except Exception as e:
             print(f"Error calling C++ program: {e}")
             return False
@@ -143,9 +306,8 @@ class CppBridge:
     def delete_photo(photo_id):
         """Delete a photo"""
         try:
-            cmd = [CPP_EXECUTABLE, "delete_photo", str(photo_id)]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            return result.returncode == 0
+            returncode, _, _ = CppBridge._run(["delete_photo", str(photo_id)])
+            return returncode == 0
         except Exception as e:
             print(f"Error calling C++ program: {e}")
             return False
@@ -154,10 +316,9 @@ class CppBridge:
     def search_photos(search_type, search_term):
         """Search photos"""
         try:
-            cmd = [CPP_EXECUTABLE, "search", search_type, search_term]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            if result.returncode == 0:
-                return json.loads(result.stdout)
+            returncode, stdout, _ = CppBridge._run(["search", search_type, search_term])
+            if returncode == 0:
+                return json.loads(stdout)
             return []
         except Exception as e:
             print(f"Error calling C++ program: {e}")
@@ -167,21 +328,23 @@ class CppBridge:
     def add_tag(photo_id, tag):
         """Add a tag to a photo"""
         try:
-            cmd = [CPP_EXECUTABLE, "add_tag", str(photo_id), tag]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            return result.returncode == 0
+            returncode, _, _ = CppBridge._run(["add_tag", str(photo_id), tag])
+            return returncode == 0
         except Exception as e:
             print(f"Error calling C++ program: {e}")
             return False
             
     @staticmethod
-    def sort_photos(sort_type, ascending=True):
-        """Sort photos"""
+    def sort_photos(sort_type, ascending=True, offset=None, limit=None):
+        """Sort photos, returning all of them or the page of up to limit
+        photos starting at offset"""
         try:
-            cmd = [CPP_EXECUTABLE, "sort", sort_type, "true" if ascending else "false"]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            if result.returncode == 0:
-                return json.loads(result.stdout)
+            cmd = ["sort", sort_type, "true" if ascending else "false"]
+            if offset is not None:
+                cmd += [str(offset)] + ([str(limit)] if limit is not None else [])
+            returncode, stdout, _ = CppBridge._run(cmd)
+            if returncode == 0:
+                return json.loads(stdout)
             return []
         except Exception as e:
             print(f"Error calling C++ program: {e}")
@@ -191,9 +354,9 @@ class CppBridge:
     def update_photo(photo_id, location, description, tags):
         """Update photo metadata"""
         try:
-            cmd = [CPP_EXECUTABLE, "update_photo", str(photo_id), location, description, tags]
-            result = subprocess.run(cmd, capture_output=True, text=True)
-            return result.returncode == 0
+            cmd = ["update_photo", str(photo_id), location, description, tags]
+            returncode, _, _ = CppBridge._run(cmd)
+            return returncode == 0
         except Exception as e:
             print(f"Error calling C++ program: {e}")
             return False
@@ -957,7 +1120,8 @@ class PhotoGalleryApp(QMainWindow):
         toolbar.addWidget(QLabel("Search by:"))
         
         self.search_type = QComboBox()
-        self.search_type.addItems(["Location", "Tag", "Date Range", "Description"])
+        self.search_type.addItems(["Location", "Tag", "Tag Query", "Date Range", "Description", "Keywords",
+                                   "Near", "Area"])
         toolbar.addWidget(self.search_type)
         
         self.search_term = QLineEdit()
@@ -1061,35 +1225,41 @@ class PhotoGalleryApp(QMainWindow):
         self.edit_image_button.hide()
         self.delete_button.hide()
     
-    def load_photos(self):
+    def show_listing(self, args):
+        """Replace the thumbnails with a C++ listing (get_all_photos, sort or
+        search arguments), adding each chunk as it streams in so the first
+        photos are on screen before the rest have been read. Returns the
+        photos shown."""
         # Clear existing thumbnails
         while self.gallery_layout.count():
             item = self.gallery_layout.takeAt(0)
             if item.widget():
                 item.widget().deleteLater()
         
-        # Get photos from C++ backend
-        photos = CppBridge.get_all_photos()
+        photos = []
+        max_cols = 4
+        for chunk, _ in CppBridge.stream_photos(args):
+            for photo in chunk:
+                thumbnail = PhotoThumbnail(photo, self.image_folder, self)
+                thumbnail.clicked.connect(self.on_thumbnail_clicked)
+                row, col = divmod(len(photos), max_cols)
+                self.gallery_layout.addWidget(thumbnail, row, col)
+                photos.append(photo)
+            
+            # Paint this chunk, but take no input until the listing is done
+            self.status_bar.showMessage(f"Loading... {len(photos)} photos")
+            QApplication.processEvents(QEventLoop.ExcludeUserInputEvents)
+        return photos
+    
+    def load_photos(self):
+        # Stream photos from C++ backend
+        photos = self.show_listing(["get_all_photos"])
         self.photos = photos
         
         if not photos:
             self.status_bar.showMessage("No photos found.")
             return
         
-        # Create thumbnails
-        row, col = 0, 0
-        max_cols = 4
-        
-        for photo in photos:
-            thumbnail = PhotoThumbnail(photo, self.image_folder, self)
-            thumbnail.clicked.connect(self.on_thumbnail_clicked)
-            self.gallery_layout.addWidget(thumbnail, row, col)
-            
-            col += 1
-            if col >= max_cols:
-                col = 0
-                row += 1
-        
         self.status_bar.showMessage(f"Loaded {len(photos)} photos")
     
     def on_thumbnail_clicked(self, photo_data, image_path):
@@ -1142,6 +1312,7 @@ class PhotoGalleryApp(QMainWindow):
         
         if file_dialog.exec():
             selected_files = file_dialog.selectedFiles()
+            records = []
             
             for file_path in selected_files:
                 # Extract metadata from image
@@ -1165,19 +1336,18 @@ class PhotoGalleryApp(QMainWindow):
                 if dialog.exec():
                     # Get edited metadata
                     metadata = dialog.get_metadata()
-                    
-                    # Add to database via C++ bridge
-                    success, _ = CppBridge.add_photo(
-                        metadata["filename"],
-                        metadata["location"],
-                        metadata["dateTime"],
-                        metadata["description"],
-                        metadata["tags"],
-                        metadata["fileSize"]
-                    )
-                    
-                    if not success:
-                        QMessageBox.warning(self, "Error", "Failed to add photo to database")
+                    records.append({key: metadata[key] for key in
+                                    ("filename", "location", "dateTime", "description", "tags", "fileSize")})
+            
+            # Add all confirmed photos to the database in one import
+            if records:
+                report = CppBridge.import_photos(records)
+                if report is None:
+                    QMessageBox.warning(self, "Error", "Failed to add photos to database")
+                elif report["skipped"]:
+                    QMessageBox.warning(self, "Error", f"{report['skipped']} photo(s) could not be added")
+                else:
+                    self.status_bar.showMessage(f"Added {report['imported']} photo(s)")
             
             # Reload photos
             self.load_photos()
@@ -1194,44 +1364,24 @@ class PhotoGalleryApp(QMainWindow):
         cpp_search_type_map = {
         "location": "location",
         "tag": "tag",  # Changed from "tag" to "prefix"
+        "tag query": "tags",  # e.g. beach AND sunset NOT people
         "date range": "date_range",
-        "description": "description"
+        "description": "description",
+        "keywords": "text",  # words, prefixes (sun*) and "quoted phrases"
+        "near": "near",  # lat, lon, radius in km
+        "area": "bbox"  # min lat, min lon, max lat, max lon
         }
         
         cpp_search_type = cpp_search_type_map.get(search_type, "location")
         
-        # Use C++ bridge to search
-        results = CppBridge.search_photos(cpp_search_type, search_term)
+        # Use C++ bridge to search, showing results as they arrive (the
+        # detail view is left as it is)
+        results = self.show_listing(["search", cpp_search_type, search_term])
         
         if not results:
             self.status_bar.showMessage(f"No photos found matching '{search_term}'")
-            # Clear gallery but don't clear detail view
-            while self.gallery_layout.count():
-                item = self.gallery_layout.takeAt(0)
-                if item.widget():
-                    item.widget().deleteLater()
             return
         
-        # Clear existing thumbnails
-        while self.gallery_layout.count():
-            item = self.gallery_layout.takeAt(0)
-            if item.widget():
-                item.widget().deleteLater()
-        
-        # Display results
-        row, col = 0, 0
-        max_cols = 4
-        
-        for photo in results:
-            thumbnail = PhotoThumbnail(photo, self.image_folder, self)
-            thumbnail.clicked.connect(self.on_thumbnail_clicked)
-            self.gallery_layout.addWidget(thumbnail, row, col)
-            
-            col += 1
-            if col >= max_cols:
-                col = 0
-                row += 1
-        
         self.status_bar.showMessage(f"Found {len(results)} photos matching '{search_term}'")
     
     def on_edit_metadata(self):
@@ -1332,32 +1482,11 @@ class PhotoGalleryApp(QMainWindow):
                 QMessageBox.warning(self, "Error", "Failed to delete photo")
     
     def on_sort(self, sort_type):
-        # Sort photos using C++ backend
-        sorted_photos = CppBridge.sort_photos(sort_type)
+        # Sort photos using C++ backend, showing them as they arrive
+        sorted_photos = self.show_listing(["sort", sort_type, "true"])
         
         if sorted_photos:
             self.photos = sorted_photos
-            
-            # Clear existing thumbnails
-            while self.gallery_layout.count():
-                item = self.gallery_layout.takeAt(0)
-                if item.widget():
-                    item.widget().deleteLater()
-            
-            # Display sorted photos
-            row, col = 0, 0
-            max_cols = 4
-            
-            for photo in sorted_photos:
-                thumbnail = PhotoThumbnail(photo, self.image_folder, self)
-                thumbnail.clicked.connect(self.on_thumbnail_clicked)
-                self.gallery_layout.addWidget(thumbnail, row, col)
-                
-                col += 1
-                if col >= max_cols:
-                    col = 0
-                    row += 1
-            
             self.status_bar.showMessage(f"Photos sorted by {sort_type}")
     
     def on_slideshow(self):
@@ -1401,6 +1530,7 @@ class PhotoGalleryApp(QMainWindow):
 
 if __name__ == "__main__":
     app = QApplication(sys.argv)
+    app.aboutToQuit.connect(CppBridge.shutdown)
     window = PhotoGalleryApp()
     window.show()
     sys.exit(app.exec())
\ No newline at end of file
@@ -0,0 +1,1664 @@
+// Benchmarks for the photo gallery backend
+// Build: g++ -std=c++11 -O2 -o photo_gallery_bench photo_gallery_bench.cpp -lsqlite3
+// Run:   ./photo_gallery_bench [benchmark...]   (no arguments runs all of them)
+
+#define PHOTO_GALLERY_NO_MAIN
+#include "photo_gallery_cli.cpp"
+#include <cstdio>
+#include <malloc.h>
+
+// Clock comes from photo_gallery_cli.cpp
+
+// Every operator new in the process is counted so benchmarks can report
+// allocation counts
+long long allocationCount = 0;
+
+void* operator new(size_t size) {
+    allocationCount++;
+    void* memory = malloc(size ? size : 1);
+    if (memory == nullptr) throw bad_alloc();
+    return memory;
+}
+
+// noinline keeps GCC from pairing the inlined free() with operator new
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+// Seconds elapsed since start
+double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Resident set size of this process in KB (Linux /proc), 0 if unavailable;
+// field "VmHWM:" gives the peak since start or the last resetPeakResident()
+long residentKB(const char* field = "VmRSS:") {
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == nullptr) return 0;
+    
+    char line[256];
+    long kb = 0;
+    size_t fieldLength = strlen(field);
+    while (fgets(line, sizeof(line), status)) {
+        if (strncmp(line, field, fieldLength) == 0) {
+            kb = atol(line + fieldLength);
+            break;
+        }
+    }
+    fclose(status);
+    return kb;
+}
+
+// Restart the peak ("VmHWM:") from the current resident set size, first
+// handing freed heap back so earlier work does not pad the baseline
+void resetPeakResident() {
+    malloc_trim(0);
+    FILE* clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs == nullptr) return;
+    fputs("5", clearRefs);
+    fclose(clearRefs);
+}
+
+// Small deterministic generator so every run builds the same library
+class SampleRandom {
+private:
+    unsigned long long state;
+
+public:
+    SampleRandom(unsigned long long seed = 42) : state(seed) {}
+    
+    unsigned int next() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned int)(state >> 33);
+    }
+    
+    int nextInt(int bound) {
+        return next() % bound;
+    }
+};
+
+const char* const SAMPLE_LOCATIONS[] = {
+    "Paris", "London", "New York", "Tokyo", "Sydney", "Rome", "Berlin", "Cairo",
+    "Mumbai", "Toronto", "Lisbon", "Oslo", "Lima", "Nairobi", "Seoul", "Prague"
+};
+const int SAMPLE_LOCATION_COUNT = sizeof(SAMPLE_LOCATIONS) / sizeof(SAMPLE_LOCATIONS[0]);
+
+const char* const SAMPLE_TAGS[] = {
+    "beach", "sunset", "family", "people", "city", "night", "food", "mountain",
+    "snow", "forest", "vacation", "birthday", "pets", "car", "river", "museum"
+};
+const int SAMPLE_TAG_COUNT = sizeof(SAMPLE_TAGS) / sizeof(SAMPLE_TAGS[0]);
+
+const char* const SAMPLE_WORDS[] = {
+    "walk", "along", "the", "beach", "at", "sunset", "with", "friends", "old",
+    "town", "market", "tower", "view", "from", "bridge", "dinner", "party"
+};
+const int SAMPLE_WORD_COUNT = sizeof(SAMPLE_WORDS) / sizeof(SAMPLE_WORDS[0]);
+
+// Build one synthetic photo with realistic field sizes
+Photo makeSamplePhoto(int id, SampleRandom& random) {
+    string description;
+    int words = 4 + random.nextInt(8);
+    for (int i = 0; i < words; i++) {
+        if (i > 0) description += ' ';
+        description += SAMPLE_WORDS[random.nextInt(SAMPLE_WORD_COUNT)];
+    }
+    
+    time_t dateTime = 1262304000 + (time_t)random.nextInt(15 * 365) * 86400;  // 2010..2025
+    Photo photo(id, "IMG_" + to_string(id) + ".jpg",
+                SAMPLE_LOCATIONS[random.nextInt(SAMPLE_LOCATION_COUNT)],
+                dateTime, description, 500 + random.nextInt(8000), random.nextInt(1000));
+    
+    int tagCount = 1 + random.nextInt(4);
+    for (int i = 0; i < tagCount; i++) {
+        photo.addTag(SAMPLE_TAGS[random.nextInt(SAMPLE_TAG_COUNT)]);
+    }
+    return photo;
+}
+
+// Benchmark: load and scan throughput of the photo store against one heap
+// allocation per Photo (the layout the gallery used before PhotoStore)
+void benchStore() {
+    const int sizes[] = { 10000, 100000, 1000000 };
+    
+    printf("%-10s %-12s %14s %14s\n", "photos", "layout", "load rows/s", "scan rows/s");
+    for (int n : sizes) {
+        vector<Photo> samples;
+        samples.reserve(n);
+        SampleRandom random;
+        for (int i = 0; i < n; i++) {
+            samples.push_back(makeSamplePhoto(i + 1, random));
+        }
+        
+        long long checksum = 0;
+        
+        // Heap-allocated photos behind a pointer array
+        {
+            Clock::time_point start = Clock::now();
+            vector<Photo*> photos;
+            for (int i = 0; i < n; i++) {
+                photos.push_back(new Photo(samples[i]));
+            }
+            double loadSeconds = secondsSince(start);
+            
+            start = Clock::now();
+            for (size_t i = 0; i < photos.size(); i++) {
+                checksum += photos[i]->getFileSize() + photos[i]->getViewCount();
+            }
+            double scanSeconds = secondsSince(start);
+            
+            printf("%-10d %-12s %14.0f %14.0f\n", n, "new Photo", n / loadSeconds, n / scanSeconds);
+            for (size_t i = 0; i < photos.size(); i++) {
+                delete photos[i];
+            }
+        }
+        
+        // Chunked photo store
+        {
+            Clock::time_point start = Clock::now();
+            PhotoStore store;
+            store.reserve(n);
+            for (int i = 0; i < n; i++) {
+                store.add(samples[i]);
+            }
+            double loadSeconds = secondsSince(start);
+            
+            start = Clock::now();
+            store.forEach([&checksum](const Photo& photo) {
+                checksum += photo.getFileSize() + photo.getViewCount();
+            });
+            double scanSeconds = secondsSince(start);
+            
+            printf("%-10d %-12s %14.0f %14.0f\n", n, "PhotoStore", n / loadSeconds, n / scanSeconds);
+        }
+        
+        if (checksum == 42) printf(" ");  // keep the scans from being optimized out
+    }
+}
+
+// Remove an on-disk database together with its WAL and snapshot files
+void removeDatabase(const string& path) {
+    ::remove(path.c_str());
+    ::remove((path + "-wal").c_str());
+    ::remove((path + "-shm").c_str());
+    ::remove((path + ".snapshot").c_str());
+}
+
+// Write a database file holding n sample photos. The rows go in through one
+// transaction on a raw connection so that setting up is not the slow part.
+void writeSampleDatabase(const string& path, int n) {
+    removeDatabase(path);
+    {
+        PhotoGallerySystem schema(path);  // creates the tables
+    }
+    
+    sqlite3* db;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    
+    sqlite3_stmt* photoStmt;
+    sqlite3_stmt* tagStmt;
+    sqlite3_prepare_v2(db, "INSERT INTO photos (id, filename, location, date_time, description, file_size, view_count) "
+                           "VALUES (?, ?, ?, ?, ?, ?, ?);", -1, &photoStmt, nullptr);
+    sqlite3_prepare_v2(db, "INSERT INTO tags (photo_id, tag) VALUES (?, ?);", -1, &tagStmt, nullptr);
+    
+    SampleRandom random;
+    for (int i = 0; i < n; i++) {
+        Photo photo = makeSamplePhoto(i + 1, random);
+        sqlite3_bind_int(photoStmt, 1, photo.getId());
+        sqlite3_bind_text(photoStmt, 2, photo.getFilename().c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(photoStmt, 3, photo.getLocation().c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(photoStmt, 4, photo.getDateTime());
+        sqlite3_bind_text(photoStmt, 5, photo.getDescription().c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(photoStmt, 6, photo.getFileSize());
+        sqlite3_bind_int(photoStmt, 7, photo.getViewCount());
+        sqlite3_step(photoStmt);
+        sqlite3_reset(photoStmt);
+        
+        for (int t = 0; t < photo.getTagCount(); t++) {
+            sqlite3_bind_int(tagStmt, 1, photo.getId());
+            sqlite3_bind_text(tagStmt, 2, photo.getTag(t).c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(tagStmt);
+            sqlite3_reset(tagStmt);
+        }
+    }
+    
+    sqlite3_finalize(photoStmt);
+    sqlite3_finalize(tagStmt);
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+}
+
+// Fill a gallery backed by an in-memory database with n sample photos
+void addSamplePhotos(PhotoGallerySystem& gallery, int n) {
+    SampleRandom random;
+    for (int i = 0; i < n; i++) {
+        Photo photo = makeSamplePhoto(i + 1, random);
+        gallery.addPhoto(photo.getFilename(), photo.getLocation(), timeToString(photo.getDateTime()),
+                         photo.getDescription(), photo.getTagsAsString(), photo.getFileSize());
+    }
+}
+
+// Benchmark: bytes per photo held in the store (the Photo plus whatever
+// its strings allocate, including string pool growth), and tag/location
+// equality scans over every photo, which compare interned symbols
+void benchStrings() {
+    const int sizes[] = { 100000, 1000000 };
+    
+    printf("sizeof(Photo): %d bytes\n", (int)sizeof(Photo));
+    printf("%-10s %16s %14s %16s\n", "photos", "bytes/photo", "tag scan ms", "location scan ms");
+    for (int n : sizes) {
+        long before = residentKB();
+        PhotoStore* store = new PhotoStore();
+        store->reserve(n);
+        SampleRandom random;
+        for (int i = 0; i < n; i++) {
+            store->add(makeSamplePhoto(i + 1, random));
+        }
+        double bytesPerPhoto = (residentKB() - before) * 1024.0 / n;
+        
+        Clock::time_point start = Clock::now();
+        int tagged = 0;
+        Symbol sunset = stringPool().find("sunset");
+        store->forEach([&](const Photo& photo) {
+            if (photo.hasTag(sunset)) tagged++;
+        });
+        double tagSeconds = secondsSince(start);
+        
+        start = Clock::now();
+        int located = 0;
+        Symbol paris = stringPool().find("Paris");
+        store->forEach([&](const Photo& photo) {
+            if (photo.getLocationSymbol() == paris) located++;
+        });
+        double locationSeconds = secondsSince(start);
+        
+        printf("%-10d %16.0f %14.1f %16.1f\n", n, bytesPerPhoto, tagSeconds * 1000, locationSeconds * 1000);
+        if (tagged + located == 42) printf(" ");  // keep the scans from being optimized out
+        delete store;
+    }
+    printf("string pool: %d symbols, %.1f MB\n", stringPool().getSymbolCount(),
+           stringPool().getMemoryUsage() / 1048576.0);
+}
+
+// Benchmark: sorts and tag/location filters over 1M photos, through Photo*
+// (the pointer-chasing path) against the columns of a PhotoTable. Both
+// sorts use std::sort with the same ordering; the last row is the
+// quickSort the gallery used to run over Photo*.
+void benchColumns() {
+    const int n = 1000000;
+    const SortType sortTypes[] = { BY_DATE, BY_SIZE, BY_VIEWS };
+    const char* const sortNames[] = { "date sort", "size sort", "views sort" };
+    
+    PhotoStore store;
+    store.reserve(n);
+    SampleRandom random;
+    for (int i = 0; i < n; i++) {
+        store.add(makeSamplePhoto(i + 1, random));
+    }
+    
+    Clock::time_point start = Clock::now();
+    PhotoTable table;
+    store.forEach([&](const Photo& photo) {
+        table.set(photo.getId() - 1, photo);
+    });
+    printf("table fill: %.1f ms for %d photos\n", secondsSince(start) * 1000, n);
+    
+    printf("%-16s %12s %12s\n", "operation", "Photo* ms", "table ms");
+    for (int s = 0; s < 3; s++) {
+        SortType sortType = sortTypes[s];
+        auto keyOf = [sortType](const Photo* photo) -> long long {
+            switch (sortType) {
+                case BY_DATE: return photo->getDateTime();
+                case BY_SIZE: return photo->getFileSize();
+                default: return photo->getViewCount();
+            }
+        };
+        
+        vector<Photo*> photos;
+        photos.reserve(n);
+        store.forEach([&](const Photo& photo) {
+            photos.push_back(const_cast<Photo*>(&photo));
+        });
+        start = Clock::now();
+        sort(photos.begin(), photos.end(), [&](const Photo* a, const Photo* b) {
+            long long keyA = keyOf(a), keyB = keyOf(b);
+            if (keyA != keyB) return keyA > keyB;
+            return a->getId() > b->getId();
+        });
+        double pointerSeconds = secondsSince(start);
+        
+        start = Clock::now();
+        vector<PhotoHandle> rows;
+        table.sortRows(sortType, true, rows);
+        double tableSeconds = secondsSince(start);
+        
+        for (int i = 0; i < n; i += n / 8) {
+            if (photos[i]->getId() != rows[i] + 1) printf("order mismatch at %d\n", i);
+        }
+        printf("%-16s %12.1f %12.1f\n", sortNames[s], pointerSeconds * 1000, tableSeconds * 1000);
+    }
+    
+    Symbol sunset = stringPool().find("sunset");
+    start = Clock::now();
+    vector<int> pointerIds;
+    store.forEach([&](const Photo& photo) {
+        if (photo.hasTag(sunset)) pointerIds.push_back(photo.getId());
+    });
+    double pointerSeconds = secondsSince(start);
+    start = Clock::now();
+    vector<int> tableIds;
+    table.findTag(sunset, store, tableIds);
+    printf("%-16s %12.1f %12.1f%s\n", "tag filter", pointerSeconds * 1000, secondsSince(start) * 1000,
+           pointerIds == tableIds ? "" : "  MISMATCH");
+    
+    Symbol paris = stringPool().find("Paris");
+    start = Clock::now();
+    pointerIds.clear();
+    store.forEach([&](const Photo& photo) {
+        if (photo.getLocationSymbol() == paris) pointerIds.push_back(photo.getId());
+    });
+    pointerSeconds = secondsSince(start);
+    start = Clock::now();
+    table.findLocation(paris, tableIds);
+    printf("%-16s %12.1f %12.1f%s\n", "location filter", pointerSeconds * 1000, secondsSince(start) * 1000,
+           pointerIds == tableIds ? "" : "  MISMATCH");
+    
+    vector<Photo*> photos;
+    photos.reserve(n);
+    store.forEach([&](const Photo& photo) {
+        photos.push_back(const_cast<Photo*>(&photo));
+    });
+    start = Clock::now();
+    quickSort(photos.data(), 0, n - 1, BY_DATE);
+    printf("%-16s %12.1f %12s\n", "date quickSort", secondsSince(start) * 1000, "-");
+}
+
+// Benchmark: radius and box queries over 1M geotagged photos, nine in ten
+// clustered around the sample cities and the rest anywhere, through the
+// GeoIndex against checking every photo's coordinates
+void benchGeo() {
+    const int n = 1000000;
+    const int queries = 200;
+    const double cities[][2] = {
+        { 48.8566, 2.3522 }, { 51.5074, -0.1278 }, { 40.7128, -74.0060 }, { 35.6762, 139.6503 },
+        { -33.8688, 151.2093 }, { 41.9028, 12.4964 }, { 52.5200, 13.4050 }, { 30.0444, 31.2357 }
+    };
+    const int cityCount = sizeof(cities) / sizeof(cities[0]);
+    
+    // Photos carry their coordinates as the GUI writes them, "lat, lon"
+    vector<Photo> photos;
+    vector<pair<double, double>> points;
+    photos.reserve(n);
+    points.reserve(n);
+    SampleRandom random;
+    char location[64];
+    for (int i = 0; i < n; i++) {
+        double latitude, longitude;
+        if (random.nextInt(10) > 0) {
+            const double* city = cities[random.nextInt(cityCount)];
+            latitude = city[0] + (random.nextInt(60000) - 30000) / 100000.0;  // within about 33 km
+            longitude = city[1] + (random.nextInt(60000) - 30000) / 100000.0;
+        } else {
+            latitude = random.nextInt(170000) / 1000.0 - 85;
+            longitude = random.nextInt(360000) / 1000.0 - 180;
+        }
+        snprintf(location, sizeof(location), "%.6f, %.6f", latitude, longitude);
+        photos.push_back(Photo(i + 1, "IMG.jpg", location, 0, "", 0, 0));
+        parseCoordinates(location, latitude, longitude);  // the rounded values the index sees
+        points.push_back(make_pair(latitude, longitude));
+    }
+    
+    Clock::time_point start = Clock::now();
+    GeoIndex index;
+    for (int i = 0; i < n; i++) {
+        index.addPhoto(photos[i]);
+    }
+    printf("build: %.0f ms for %d photos in %d cells\n", secondsSince(start) * 1000, index.getSize(),
+           index.getCellCount());
+    
+    struct GeoQuery {
+        const char* name;
+        double radiusKm;  // 0 for a box
+        double boxDegrees;
+    };
+    const GeoQuery shapes[] = {
+        { "near 1 km", 1, 0 }, { "near 5 km", 5, 0 }, { "near 50 km", 50, 0 }, { "near 1000 km", 1000, 0 },
+        { "box 0.1 deg", 0, 0.1 }, { "box 1 deg", 0, 1 }
+    };
+    
+    printf("%-14s %10s %12s %12s\n", "query", "avg hits", "index us", "scan us");
+    for (const GeoQuery& shape : shapes) {
+        vector<pair<double, double>> centers;
+        for (int q = 0; q < queries; q++) {
+            const double* city = cities[q % cityCount];
+            centers.push_back(make_pair(city[0] + (random.nextInt(20000) - 10000) / 100000.0,
+                                        city[1] + (random.nextInt(20000) - 10000) / 100000.0));
+        }
+        
+        vector<int> photoIds;
+        size_t indexHits = 0;
+        start = Clock::now();
+        for (int q = 0; q < queries; q++) {
+            double lat = centers[q].first, lon = centers[q].second;
+            if (shape.radiusKm > 0) {
+                index.searchNear(lat, lon, shape.radiusKm, photoIds);
+            } else {
+                double half = shape.boxDegrees / 2;
+                index.searchBox(lat - half, lon - half, lat + half, lon + half, photoIds);
+            }
+            indexHits += photoIds.size();
+        }
+        double indexSeconds = secondsSince(start);
+        
+        size_t scanHits = 0;
+        start = Clock::now();
+        for (int q = 0; q < queries; q++) {
+            double lat = centers[q].first, lon = centers[q].second;
+            double half = shape.boxDegrees / 2;
+            photoIds.clear();
+            for (int i = 0; i < n; i++) {
+                bool hit = shape.radiusKm > 0
+                    ? distanceKm(lat, lon, points[i].first, points[i].second) <= shape.radiusKm
+                    : points[i].first >= lat - half && points[i].first <= lat + half &&
+                      points[i].second >= lon - half && points[i].second <= lon + half;
+                if (hit) photoIds.push_back(i + 1);
+            }
+            scanHits += photoIds.size();
+        }
+        double scanSeconds = secondsSince(start);
+        
+        printf("%-14s %10.0f %12.1f %12.1f%s\n", shape.name, (double)indexHits / queries,
+               indexSeconds * 1e6 / queries, scanSeconds * 1e6 / queries, indexHits == scanHits ? "" : "  MISMATCH");
+    }
+}
+
+// The location map the gallery used before the Robin Hood HashMap: 101
+// chained buckets, at most 100 photo IDs per location
+class ChainedLocationMap {
+private:
+    struct Node {
+        Symbol key;
+        int photoIds[100];
+        int count;
+        Node* next;
+    };
+    static const int TABLE_SIZE = 101;
+    Node* table[TABLE_SIZE];
+
+public:
+    ChainedLocationMap() {
+        fill(table, table + TABLE_SIZE, (Node*)nullptr);
+    }
+    
+    ~ChainedLocationMap() {
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            while (table[i] != nullptr) {
+                Node* next = table[i]->next;
+                delete table[i];
+                table[i] = next;
+            }
+        }
+    }
+    
+    void insert(Symbol key, int photoId) {
+        Node* current = table[key % TABLE_SIZE];
+        for (; current != nullptr; current = current->next) {
+            if (current->key != key) continue;
+            for (int i = 0; i < current->count; i++) {
+                if (current->photoIds[i] == photoId) return;
+            }
+            if (current->count < 100) current->photoIds[current->count++] = photoId;
+            return;
+        }
+        Node* node = new Node();
+        node->key = key;
+        node->photoIds[0] = photoId;
+        node->count = 1;
+        node->next = table[key % TABLE_SIZE];
+        table[key % TABLE_SIZE] = node;
+    }
+    
+    int count(Symbol key) const {
+        for (Node* current = table[key % TABLE_SIZE]; current != nullptr; current = current->next) {
+            if (current->key == key) return current->count;
+        }
+        return 0;
+    }
+};
+
+// Benchmark: location map inserts and lookups with 1M photos spread over
+// 100 to 100k locations, for the old chained map, std::unordered_map and
+// the Robin Hood HashMap. Lookups are by interned symbol; "by name" adds
+// the string pool lookup searchByLocation does first. "kept" is the share
+// of photo IDs a lookup of every location gets back.
+void benchLocations() {
+    const int n = 1000000;
+    const int locationCounts[] = { 100, 10000, 100000 };
+    const int lookups = 1000000;
+    
+    printf("%-10s %-16s %14s %14s %14s %8s\n", "locations", "map", "inserts/s", "lookups/s", "by name/s", "kept");
+    for (int locationCount : locationCounts) {
+        vector<Symbol> keys(locationCount);
+        vector<string> names(locationCount);
+        for (int i = 0; i < locationCount; i++) {
+            names[i] = "Location " + to_string(locationCount) + "/" + to_string(i);
+            keys[i] = stringPool().intern(names[i]);
+        }
+        SampleRandom random;
+        vector<Symbol> photoKeys(n);
+        for (int i = 0; i < n; i++) {
+            photoKeys[i] = keys[random.nextInt(locationCount)];
+        }
+        vector<int> probes(lookups);
+        for (int i = 0; i < lookups; i++) {
+            probes[i] = random.nextInt(locationCount);
+        }
+        
+        // Old chained map
+        {
+            ChainedLocationMap* map = new ChainedLocationMap();
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < n; i++) {
+                map->insert(photoKeys[i], i + 1);
+            }
+            double insertSeconds = secondsSince(start);
+            
+            start = Clock::now();
+            long long found = 0;
+            for (int i = 0; i < lookups; i++) {
+                found += map->count(keys[probes[i]]);
+            }
+            double lookupSeconds = secondsSince(start);
+            
+            long long kept = 0;
+            for (int i = 0; i < locationCount; i++) {
+                kept += map->count(keys[i]);
+            }
+            printf("%-10d %-16s %14.0f %14.0f %14s %7.1f%%\n", locationCount, "chained (old)", n / insertSeconds,
+                   lookups / lookupSeconds, "-", 100.0 * kept / n);
+            if (found == 42) printf(" ");
+            delete map;
+        }
+        
+        // std::unordered_map with sorted posting lists
+        {
+            unordered_map<Symbol, vector<int> > map;
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < n; i++) {
+                insertSortedId(map[photoKeys[i]], i + 1);
+            }
+            double insertSeconds = secondsSince(start);
+            
+            start = Clock::now();
+            long long found = 0;
+            for (int i = 0; i < lookups; i++) {
+                unordered_map<Symbol, vector<int> >::const_iterator it = map.find(keys[probes[i]]);
+                if (it != map.end()) found += it->second.size();
+            }
+            double lookupSeconds = secondsSince(start);
+            
+            printf("%-10d %-16s %14.0f %14.0f %14s %7.1f%%\n", locationCount, "unordered_map", n / insertSeconds,
+                   lookups / lookupSeconds, "-", 100.0);
+            if (found == 42) printf(" ");
+        }
+        
+        // Robin Hood HashMap
+        {
+            HashMap map;
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < n; i++) {
+                map.insert(photoKeys[i], i + 1);
+            }
+            double insertSeconds = secondsSince(start);
+            
+            start = Clock::now();
+            long long found = 0;
+            for (int i = 0; i < lookups; i++) {
+                const vector<int>* photoIds = map.find(keys[probes[i]]);
+                if (photoIds != nullptr) found += photoIds->size();
+            }
+            double lookupSeconds = secondsSince(start);
+            
+            start = Clock::now();
+            for (int i = 0; i < lookups; i++) {
+                const vector<int>* photoIds = map.find(names[probes[i]]);
+                if (photoIds != nullptr) found += photoIds->size();
+            }
+            double nameSeconds = secondsSince(start);
+            
+            long long kept = 0;
+            for (int i = 0; i < locationCount; i++) {
+                const vector<int>* photoIds = map.find(names[i]);
+                if (photoIds != nullptr) kept += photoIds->size();
+            }
+            printf("%-10d %-16s %14.0f %14.0f %14.0f %7.1f%%\n", locationCount, "Robin Hood", n / insertSeconds,
+                   lookups / lookupSeconds, lookups / nameSeconds, 100.0 * kept / n);
+            if (found == 42) printf(" ");
+        }
+    }
+}
+
+// Benchmark: sustained views/sec at 100k photos. The first two rows time only
+// the popularity structures: rebuilding them on every view (what viewPhoto
+// used to do) against removing and reinserting the one changed key. The last
+// row is the whole viewPhoto path, including the UPDATE on an in-memory DB.
+void benchViews() {
+    const int n = 100000;
+    
+    PhotoStore store;
+    vector<PhotoHandle> handles;
+    AVLTree popularityTree;
+    PriorityQueue popularQueue(true);
+    SampleRandom random;
+    for (int i = 0; i < n; i++) {
+        PhotoHandle handle = store.add(makeSamplePhoto(i + 1, random));
+        Photo* photo = store.get(handle);
+        handles.push_back(handle);
+        popularityTree.insert(photo->getViewCount(), photo->getId(), handle);
+        popularQueue.insert(photo);
+    }
+    
+    printf("%-28s %12s\n", "method (100k photos)", "views/s");
+    
+    const int rebuildViews = 20;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < rebuildViews; i++) {
+        store.get(handles[random.nextInt(n)])->incrementViewCount();
+        popularityTree.clear();
+        popularQueue.clear();
+        for (int j = 0; j < n; j++) {
+            Photo* photo = store.get(handles[j]);
+            popularityTree.insert(photo->getViewCount(), photo->getId(), handles[j]);
+            popularQueue.insert(photo);
+        }
+    }
+    printf("%-28s %12.0f\n", "rebuild per view", rebuildViews / secondsSince(start));
+    
+    const int incrementalViews = 1000000;
+    start = Clock::now();
+    for (int i = 0; i < incrementalViews; i++) {
+        PhotoHandle handle = handles[random.nextInt(n)];
+        Photo* photo = store.get(handle);
+        popularityTree.remove(photo->getViewCount(), photo->getId());
+        photo->incrementViewCount();
+        popularityTree.insert(photo->getViewCount(), photo->getId(), handle);
+        popularQueue.update(photo);
+    }
+    printf("%-28s %12.0f\n", "incremental remove/insert", incrementalViews / secondsSince(start));
+    
+    PhotoGallerySystem gallery(":memory:");
+    addSamplePhotos(gallery, n);
+    const int galleryViews = 200000;
+    start = Clock::now();
+    for (int i = 0; i < galleryViews; i++) {
+        gallery.viewPhoto(1 + random.nextInt(n));
+    }
+    printf("%-28s %12.0f\n", "viewPhoto (in-memory DB)", galleryViews / secondsSince(start));
+}
+
+// Benchmark: memory and date-range query cost of the date and popularity
+// trees at 100k photos (peak RSS growth while building both trees, measured
+// from a trimmed heap so that earlier benchmarks' freed memory is not reused
+// for free)
+void benchTrees() {
+    const int n = 100000;
+    
+    PhotoStore store;
+    SampleRandom random;
+    for (int i = 0; i < n; i++) {
+        store.add(makeSamplePhoto(i + 1, random));
+    }
+    
+    resetPeakResident();
+    long before = residentKB();
+    AVLTree dateTree;
+    AVLTree popularityTree;
+    Clock::time_point start = Clock::now();
+    for (PhotoHandle h = 0; h < store.slotCount(); h++) {
+        const Photo* photo = store.get(h);
+        dateTree.insert(photo->getDateTime(), photo->getId(), h);
+        popularityTree.insert(photo->getViewCount(), photo->getId(), h);
+    }
+    double buildSeconds = secondsSince(start);
+    long peak = residentKB("VmHWM:") - before;
+    
+    printf("photos:                   %d\n", n);
+    printf("AVLNode size:             %zu bytes\n", sizeof(AVLNode));
+    printf("RSS for both trees:       %ld KB (%.1f bytes/photo)\n", peak, peak * 1024.0 / n);
+    printf("build both trees:         %.3f s\n", buildSeconds);
+    
+    // One-year windows across the sample date range
+    const int queries = 1000;
+    long long hits = 0;
+    vector<PhotoHandle> results;
+    start = Clock::now();
+    for (int i = 0; i < queries; i++) {
+        long long from = 1262304000LL + (long long)random.nextInt(14 * 365) * 86400;
+        dateTree.searchByKeyRange(from, from + 365LL * 86400, results);
+        hits += results.size();
+    }
+    double querySeconds = secondsSince(start);
+    printf("1-year date range query:  %.1f us (%lld hits avg)\n", querySeconds * 1e6 / queries, hits / queries);
+}
+
+// Benchmark: one 40-photo page of a sorted listing at 1M photos, cut from a
+// full sort of the photo table (what sort cost per page before pagination)
+// versus read from an order-statistic tree with getRange(), which also
+// checks each page against the sorted table
+void benchPages() {
+    const int n = 1000000;
+    const int pageSize = 40;
+    const SortType sortTypes[] = { BY_DATE, BY_SIZE, BY_VIEWS };
+    const char* const sortNames[] = { "date", "size", "views" };
+    const int offsets[] = { 0, n / 2, n - pageSize };
+    
+    PhotoStore store;
+    store.reserve(n);
+    SampleRandom random;
+    for (int i = 0; i < n; i++) {
+        store.add(makeSamplePhoto(i + 1, random));
+    }
+    PhotoTable table;
+    store.forEach([&](const Photo& photo) {
+        table.set(photo.getId() - 1, photo);
+    });
+    
+    printf("%-24s %12s %12s\n", "page of 40 (1M photos)", "sort ms", "tree us");
+    for (int s = 0; s < 3; s++) {
+        SortType sortType = sortTypes[s];
+        auto keyOf = [&](PhotoHandle handle) -> long long {
+            const Photo* photo = store.get(handle);
+            switch (sortType) {
+                case BY_DATE: return photo->getDateTime();
+                case BY_SIZE: return photo->getFileSize();
+                default: return photo->getViewCount();
+            }
+        };
+        
+        // The table sorts ties by ID, so its rows are already in tree order
+        vector<PhotoHandle> rows;
+        table.sortRows(sortType, false, rows);
+        Clock::time_point start = Clock::now();
+        AVLTree tree;
+        tree.buildSorted(rows.data(), n, keyOf, [&](PhotoHandle handle) {
+            return store.get(handle)->getId();
+        });
+        double buildSeconds = secondsSince(start);
+        
+        for (int o = 0; o < 3; o++) {
+            int offset = offsets[o];
+            start = Clock::now();
+            table.sortRows(sortType, false, rows);
+            vector<PhotoHandle> sortPage(rows.begin() + offset, rows.begin() + offset + pageSize);
+            double sortSeconds = secondsSince(start);
+            
+            const int repeats = 1000;
+            vector<PhotoHandle> treePage;
+            start = Clock::now();
+            for (int r = 0; r < repeats; r++) {
+                tree.getRange(offset, pageSize, true, treePage);
+            }
+            double treeSeconds = secondsSince(start) / repeats;
+            
+            bool matches = (treePage == sortPage) && tree.select(offset) == sortPage[0] &&
+                           tree.rank(keyOf(sortPage[0]), store.get(sortPage[0])->getId()) == offset;
+            char label[64];
+            snprintf(label, sizeof(label), "%s @ %d", sortNames[s], offset);
+            printf("%-24s %12.1f %12.2f%s\n", label, sortSeconds * 1000, treeSeconds * 1e6,
+                   matches ? "" : "  MISMATCH");
+        }
+        printf("%-24s %12s %12.1f ms\n", "  tree build", "", buildSeconds * 1000);
+    }
+}
+
+// Benchmark: opening a 100k-photo database with no snapshot, i.e.
+// loadPhotosFromDB() filling the store and primary key index plus writing
+// the snapshot, with the number of heap allocations
+void benchLoad() {
+    const int n = 100000;
+    const string path = "bench_load.db";
+    writeSampleDatabase(path, n);
+    
+    long long allocationsBefore = allocationCount;
+    Clock::time_point start = Clock::now();
+    Clock::time_point teardownStart;
+    {
+        PhotoGallerySystem gallery(path);
+        double loadSeconds = secondsSince(start);
+        long long allocations = allocationCount - allocationsBefore;
+        
+        printf("photos:        %d\n", gallery.getPhotoCount());
+        printf("load time:     %.3f s\n", loadSeconds);
+        printf("allocations:   %lld (%.1f per photo)\n", allocations, (double)allocations / n);
+        teardownStart = Clock::now();
+    }
+    printf("teardown:      %.3f s\n", secondsSince(teardownStart));
+    removeDatabase(path);
+}
+
+// The Trie layout before the compact rewrite: 36 child pointers and 100
+// inline photo IDs in every node
+class LegacyTrieNode {
+public:
+    LegacyTrieNode* children[36]; // a-z and 0-9
+    bool isEndOfWord;
+    int photoIds[100];  // Store photo IDs that contain this tag/word
+    int photoCount;
+    
+    LegacyTrieNode() : isEndOfWord(false), photoCount(0) {
+        for (int i = 0; i < 36; i++)
+            children[i] = nullptr;
+    }
+};
+
+class LegacyTrie {
+private:
+    LegacyTrieNode* root;
+    NodePool<LegacyTrieNode> nodes;  // owns every node; freed together with the trie
+    
+    // Convert character to index (a-z, 0-9)
+    int charToIndex(char c) {
+        if (c >= 'a' && c <= 'z')
+            return c - 'a';
+        if (c >= 'A' && c <= 'Z')
+            return c - 'A';
+        if (c >= '0' && c <= '9')
+            return c - '0' + 26;
+        return -1; // Invalid character
+    }
+    
+    void searchPrefix(LegacyTrieNode* node, const string& prefix, vector<int>& photoIds) {
+        if (node->isEndOfWord) {
+            for (int i = 0; i < node->photoCount; i++) {
+                if (find(photoIds.begin(), photoIds.end(), node->photoIds[i]) == photoIds.end()) {
+                    photoIds.push_back(node->photoIds[i]);
+                }
+            }
+        }
+        
+        for (int i = 0; i < 36; i++) {
+            if (node->children[i]) {
+                searchPrefix(node->children[i], prefix, photoIds);
+            }
+        }
+    }
+
+public:
+    LegacyTrie() {
+        root = nodes.create();
+    }
+    
+    void insert(const string& key, int photoId) {
+        LegacyTrieNode* node = root;
+        
+        for (size_t i = 0; i < key.length(); i++) {
+            int index = charToIndex(key[i]);
+            if (index == -1) continue; // Skip invalid characters
+            
+            if (!node->children[index])
+                node->children[index] = nodes.create();
+            
+            node = node->children[index];
+        }
+        
+        // Mark last node as leaf and add photo ID
+        node->isEndOfWord = true;
+        
+        // Add photo ID if not already present
+        bool exists = false;
+        for (int i = 0; i < node->photoCount; i++) {
+            if (node->photoIds[i] == photoId) {
+                exists = true;
+                break;
+            }
+        }
+        
+        if (!exists && node->photoCount < 100) {
+            node->photoIds[node->photoCount++] = photoId;
+        }
+    }
+    
+    void searchByPrefix(const string& prefix, vector<int>& photoIds) {
+        LegacyTrieNode* node = root;
+        photoIds.clear();
+        
+        // Navigate to the end of prefix
+        for (size_t i = 0; i < prefix.length(); i++) {
+            int index = charToIndex(prefix[i]);
+            if (index == -1) continue; // Skip invalid characters
+            
+            if (!node->children[index])
+                return; // Prefix not found
+            
+            node = node->children[index];
+        }
+        
+        // Find all words with the given prefix
+        searchPrefix(node, prefix, photoIds);
+    }
+    
+    int getNodeCount() const {
+        return nodes.getLiveCount();
+    }
+};
+
+// Benchmark: memory and prefix lookups of the compact trie against the old
+// layout. 100k photos carry three tags each from a 20k-word vocabulary, and
+// every photo also has "family".
+void benchTrie() {
+    const int n = 100000;
+    const int vocabularySize = 20000;
+    
+    SampleRandom random;
+    vector<string> vocabulary;
+    for (int i = 0; i < vocabularySize; i++) {
+        string word;
+        int length = 4 + random.nextInt(7);
+        for (int c = 0; c < length; c++) {
+            word += (char)('a' + random.nextInt(26));
+        }
+        vocabulary.push_back(word);
+    }
+    
+    vector<int> photoTags;  // three vocabulary indices per photo
+    for (int i = 0; i < n * 3; i++) {
+        photoTags.push_back(random.nextInt(vocabularySize));
+    }
+    
+    LegacyTrie legacy;
+    Clock::time_point start = Clock::now();
+    for (int id = 1; id <= n; id++) {
+        for (int t = 0; t < 3; t++) {
+            legacy.insert(vocabulary[photoTags[(id - 1) * 3 + t]], id);
+        }
+        legacy.insert("family", id);
+    }
+    double legacyBuild = secondsSince(start);
+    
+    Trie compact;
+    start = Clock::now();
+    for (int id = 1; id <= n; id++) {
+        for (int t = 0; t < 3; t++) {
+            compact.insert(vocabulary[photoTags[(id - 1) * 3 + t]], id);
+        }
+        compact.insert("family", id);
+    }
+    double compactBuild = secondsSince(start);
+    
+    vector<int> ids;
+    legacy.searchByPrefix("family", ids);
+    size_t legacyFamily = ids.size();
+    compact.searchByPrefix("family", ids);
+    size_t compactFamily = ids.size();
+    
+    size_t legacyBytes = (size_t)legacy.getNodeCount() * sizeof(LegacyTrieNode);
+    printf("%-8s %10s %14s %10s %16s\n", "layout", "nodes", "memory", "build s", "'family' hits");
+    printf("%-8s %10d %11.1f MB %10.3f %16zu\n", "legacy", legacy.getNodeCount(), legacyBytes / 1048576.0, legacyBuild, legacyFamily);
+    printf("%-8s %10d %11.1f MB %10.3f %16zu\n", "compact", compact.getNodeCount(), compact.getMemoryUsage() / 1048576.0, compactBuild, compactFamily);
+    
+    // Three-letter prefix queries
+    vector<string> prefixes;
+    for (int i = 0; i < 2000; i++) {
+        prefixes.push_back(vocabulary[random.nextInt(vocabularySize)].substr(0, 3));
+    }
+    
+    long long legacyHits = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        legacy.searchByPrefix(prefixes[i], ids);
+        legacyHits += ids.size();
+    }
+    double legacyQuery = secondsSince(start);
+    
+    long long compactHits = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        compact.searchByPrefix(prefixes[i], ids);
+        compactHits += ids.size();
+    }
+    double compactQuery = secondsSince(start);
+    
+    printf("3-letter prefix query: legacy %.1f us (%lld hits avg), compact %.1f us (%lld hits avg)\n",
+           legacyQuery * 1e6 / prefixes.size(), legacyHits / (long long)prefixes.size(),
+           compactQuery * 1e6 / prefixes.size(), compactHits / (long long)prefixes.size());
+}
+
+// Benchmark: boolean tag queries over posting lists against evaluating the
+// same query with Photo::hasTag on every photo, plus raw intersection
+// throughput of intersectSortedIds against std::set_intersection
+void benchTags() {
+    const int n = 1000000;
+    
+    vector<Photo> photos;
+    photos.reserve(n);
+    SampleRandom random;
+    TagIndex index;
+    vector<int> allIds;
+    for (int id = 1; id <= n; id++) {
+        photos.push_back(makeSamplePhoto(id, random));
+        if (random.nextInt(1000) == 0) photos.back().addTag("rare");
+        index.addPhoto(photos.back());
+        allIds.push_back(id);
+    }
+    
+    struct NaiveQuery {
+        const char* text;
+        bool (*matches)(const Photo&);
+    };
+    const NaiveQuery queries[] = {
+        { "beach AND sunset",
+          [](const Photo& p) { return p.hasTag("beach") && p.hasTag("sunset"); } },
+        { "beach AND sunset NOT people",
+          [](const Photo& p) { return p.hasTag("beach") && p.hasTag("sunset") && !p.hasTag("people"); } },
+        { "rare AND family",
+          [](const Photo& p) { return p.hasTag("rare") && p.hasTag("family"); } },
+        { "(city OR night) AND food",
+          [](const Photo& p) { return (p.hasTag("city") || p.hasTag("night")) && p.hasTag("food"); } },
+        { "NOT beach NOT sunset",
+          [](const Photo& p) { return !p.hasTag("beach") && !p.hasTag("sunset"); } },
+    };
+    
+    printf("%-30s %8s %12s %12s %9s\n", "query", "hits", "hasTag ms", "index ms", "speedup");
+    for (const NaiveQuery& query : queries) {
+        Clock::time_point start = Clock::now();
+        size_t naiveHits = 0;
+        for (int i = 0; i < n; i++) {
+            if (query.matches(photos[i])) naiveHits++;
+        }
+        double naiveSeconds = secondsSince(start);
+        
+        const int repeats = 20;
+        vector<int> ids;
+        start = Clock::now();
+        for (int r = 0; r < repeats; r++) {
+            TagQuery tagQuery;
+            tagQuery.parse(query.text);
+            tagQuery.evaluate(index, allIds, ids);
+        }
+        double indexSeconds = secondsSince(start) / repeats;
+        
+        printf("%-30s %8zu %12.2f %12.3f %8.0fx%s\n", query.text, ids.size(), naiveSeconds * 1e3,
+               indexSeconds * 1e3, naiveSeconds / indexSeconds, ids.size() == naiveHits ? "" : "  MISMATCH");
+    }
+    
+    // Kernel throughput in input IDs per second
+    const vector<int>& beach = *index.find("beach");
+    const vector<int>& sunset = *index.find("sunset");
+    const vector<int>& rare = *index.find("rare");
+    const int repeats = 50;
+    vector<int> result;
+    
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < repeats; r++) {
+        result.clear();
+        set_intersection(beach.begin(), beach.end(), sunset.begin(), sunset.end(), back_inserter(result));
+    }
+    double stdSeconds = secondsSince(start);
+    
+    start = Clock::now();
+    for (int r = 0; r < repeats; r++) {
+        intersectSortedIds(beach, sunset, result);
+    }
+    double kernelSeconds = secondsSince(start);
+    
+    start = Clock::now();
+    for (int r = 0; r < repeats; r++) {
+        intersectSortedIds(rare, beach, result);
+    }
+    double gallopSeconds = secondsSince(start);
+    
+    double inputIds = (double)(beach.size() + sunset.size()) * repeats;
+    printf("beach & sunset (%zu x %zu ids): set_intersection %.0f M ids/s, intersectSortedIds %.0f M ids/s\n",
+           beach.size(), sunset.size(), inputIds / stdSeconds / 1e6, inputIds / kernelSeconds / 1e6);
+    printf("rare & beach (%zu x %zu ids, galloping): %.1f us per intersection\n",
+           rare.size(), beach.size(), gallopSeconds * 1e6 / repeats);
+}
+
+// Benchmark: description queries through the full-text index against the
+// KMP scan of every description, as the library grows
+void benchText() {
+    const int sizes[] = { 10000, 100000, 1000000 };
+    const char* const queries[] = { "sunset", "bridge dinner", "\"old town\"", "mark*" };
+    const char* const scanQueries[] = { "sunset", "bridge", "old town", "mark" };
+    const int queryCount = sizeof(queries) / sizeof(queries[0]);
+    const string path = "bench_text.db";
+    
+    printf("%-10s %-16s %8s %12s %12s\n", "photos", "query", "hits", "index us", "KMP scan us");
+    for (int n : sizes) {
+        writeSampleDatabase(path, n);
+        PhotoGallerySystem gallery(path);
+        
+        vector<Photo*> results;
+        for (int q = 0; q < queryCount; q++) {
+            const int repeats = 20;
+            Clock::time_point start = Clock::now();
+            for (int r = 0; r < repeats; r++) {
+                gallery.searchByText(queries[q], results);
+            }
+            double indexSeconds = secondsSince(start) / repeats;
+            size_t hits = results.size();
+            
+            start = Clock::now();
+            gallery.searchByDescription(scanQueries[q], results);
+            double scanSeconds = secondsSince(start);
+            
+            printf("%-10d %-16s %8zu %12.1f %12.1f\n", n, queries[q], hits, indexSeconds * 1e6, scanSeconds * 1e6);
+        }
+    }
+    removeDatabase(path);
+}
+
+// Benchmark: substring queries through the suffix array index against the
+// per-photo lowercase + KMP scan that search description used before, with
+// build time and memory for whole-library and 4 MB shards
+void benchSubstring() {
+    const int sizes[] = { 100000, 1000000 };
+    const char* const patterns[] = { "ach", "own mark", "sunset with", "zzz" };
+    const int patternCount = sizeof(patterns) / sizeof(patterns[0]);
+    
+    for (int n : sizes) {
+        vector<Photo> photos;
+        photos.reserve(n);
+        SampleRandom random;
+        for (int i = 0; i < n; i++) {
+            photos.push_back(makeSamplePhoto(i + 1, random));
+        }
+        
+        const size_t shardSizes[] = { (size_t)1 << 30, (size_t)4 << 20 };
+        SubstringIndex index;
+        for (size_t shardBytes : shardSizes) {
+            SubstringIndex sharded(shardBytes);
+            Clock::time_point start = Clock::now();
+            sharded.beginBuild();
+            for (int i = 0; i < n; i++) {
+                sharded.addDocument(photos[i].getId(), foldCase(photos[i].getDescription()));
+            }
+            sharded.endBuild();
+            printf("%d photos, %4d shard(s): build %.2f s, %.1f MB\n", n, sharded.getShardCount(),
+                   secondsSince(start), sharded.getMemoryUsage() / 1048576.0);
+            index = sharded;
+        }
+        
+        printf("%-14s %8s %12s %12s\n", "pattern", "hits", "index us", "KMP scan us");
+        for (int q = 0; q < patternCount; q++) {
+            string pattern = patterns[q];
+            const int repeats = 10;
+            vector<int> ids;
+            Clock::time_point start = Clock::now();
+            for (int r = 0; r < repeats; r++) {
+                index.search(pattern, [](int) { return (const string*)nullptr; }, ids);
+            }
+            double indexSeconds = secondsSince(start) / repeats;
+            
+            size_t scanHits = 0;
+            start = Clock::now();
+            for (int i = 0; i < n; i++) {
+                string lowerDesc = photos[i].getDescription();
+                for (size_t j = 0; j < lowerDesc.length(); j++) {
+                    lowerDesc[j] = tolower(lowerDesc[j]);
+                }
+                if (KMPSearch(lowerDesc, pattern)) scanHits++;
+            }
+            double scanSeconds = secondsSince(start);
+            
+            printf("%-14s %8zu %12.1f %12.1f%s\n", patterns[q], ids.size(), indexSeconds * 1e6, scanSeconds * 1e6,
+                   ids.size() == scanHits ? "" : "  MISMATCH");
+        }
+        printf("\n");
+    }
+}
+
+// Benchmark: scanning every description for a substring, in GB/s of
+// description text. The KMP row is the old per-photo path (copy, lowercase,
+// KMPSearch); the kernel rows scan descriptions folded once up front.
+void benchScan() {
+    const int n = 1000000;
+    const char* const patterns[] = { "ach", "sunset with", "zzz" };
+    
+    vector<Photo> photos;
+    vector<string> folded;
+    photos.reserve(n);
+    folded.reserve(n);
+    SampleRandom random;
+    size_t totalBytes = 0;
+    for (int i = 0; i < n; i++) {
+        photos.push_back(makeSamplePhoto(i + 1, random));
+        folded.push_back(foldCase(photos.back().getDescription()));
+        totalBytes += folded.back().length();
+    }
+    
+    struct Kernel {
+        const char* name;
+        ContainsKernel contains;
+    };
+    vector<Kernel> kernels;
+    Kernel scalar = { "scalar", containsFoldedScalar };
+    kernels.push_back(scalar);
+#ifdef __SSE2__
+    Kernel sse2 = { "SSE2", containsFoldedSSE2 };
+    kernels.push_back(sse2);
+#endif
+#ifdef PHOTO_GALLERY_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        Kernel avx2 = { "AVX2", containsFoldedAVX2 };
+        kernels.push_back(avx2);
+    }
+#endif
+    Kernel dispatched = { "dispatched", containsFoldedKernel };
+    kernels.push_back(dispatched);
+    
+    printf("%.1f MB of descriptions over %d photos\n", totalBytes / 1048576.0, n);
+    printf("%-14s %-12s %8s %10s\n", "pattern", "method", "hits", "GB/s");
+    for (const char* patternText : patterns) {
+        string pattern = patternText;
+        
+        Clock::time_point start = Clock::now();
+        size_t hits = 0;
+        for (int i = 0; i < n; i++) {
+            string lowerDesc = photos[i].getDescription();
+            for (size_t j = 0; j < lowerDesc.length(); j++) {
+                lowerDesc[j] = tolower(lowerDesc[j]);
+            }
+            if (KMPSearch(lowerDesc, pattern)) hits++;
+        }
+        printf("%-14s %-12s %8zu %10.2f\n", patternText, "KMP", hits, totalBytes / secondsSince(start) / 1e9);
+        
+        for (size_t k = 0; k < kernels.size(); k++) {
+            start = Clock::now();
+            size_t kernelHits = 0;
+            for (int i = 0; i < n; i++) {
+                if (kernels[k].contains(folded[i].data(), folded[i].length(), pattern.data(), pattern.length())) {
+                    kernelHits++;
+                }
+            }
+            printf("%-14s %-12s %8zu %10.2f%s\n", patternText, kernels[k].name, kernelHits,
+                   totalBytes / secondsSince(start) / 1e9, kernelHits == hits ? "" : "  MISMATCH");
+        }
+    }
+    
+    // Per-photo calls are short; one long text shows the kernels' peak rate
+    string joined;
+    joined.reserve(totalBytes + n);
+    for (int i = 0; i < n; i++) {
+        joined += folded[i];
+        joined += '\n';
+    }
+    const char* const missingPatterns[] = { "zzz", "the zoo" };
+    for (const char* missing : missingPatterns) {
+        for (size_t k = 0; k < kernels.size(); k++) {
+            Clock::time_point start = Clock::now();
+            bool found = kernels[k].contains(joined.data(), joined.length(), missing, strlen(missing));
+            printf("%-14s %-12s %8d %10.2f  (one %.0f MB text)\n", missing, kernels[k].name, found ? 1 : 0,
+                   joined.length() / secondsSince(start) / 1e9, joined.length() / 1048576.0);
+        }
+    }
+}
+
+// Benchmark: adding photos to an on-disk database one addPhoto call at a
+// time (autocommit, one transaction per row) against importPhotos (one
+// transaction, statements reused, indexes updated after the commit)
+void benchImport() {
+    const int perPhotoCount = 1000;
+    const int importCount = 20000;
+    const string path = "bench_import.db";
+    
+    vector<Photo> samples;
+    SampleRandom random;
+    for (int i = 0; i < importCount; i++) {
+        samples.push_back(makeSamplePhoto(i + 1, random));
+    }
+    
+    printf("%-22s %8s %12s\n", "method", "photos", "rows/s");
+    
+    removeDatabase(path);
+    {
+        PhotoGallerySystem gallery(path);
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < perPhotoCount; i++) {
+            const Photo& photo = samples[i];
+            gallery.addPhoto(photo.getFilename(), photo.getLocation(), timeToString(photo.getDateTime()),
+                             photo.getDescription(), photo.getTagsAsString(), photo.getFileSize());
+        }
+        printf("%-22s %8d %12.0f\n", "addPhoto per photo", perPhotoCount, perPhotoCount / secondsSince(start));
+    }
+    
+    removeDatabase(path);
+    {
+        PhotoGallerySystem gallery(path);
+        vector<Photo> photos(samples);
+        Clock::time_point start = Clock::now();
+        int imported = gallery.importPhotos(photos);
+        printf("%-22s %8d %12.0f\n", "importPhotos", imported, imported / secondsSince(start));
+    }
+    removeDatabase(path);
+}
+
+// Benchmark: latency of a one-shot CLI invocation per command type, from
+// opening a 100k-photo database to the command's output, loading from
+// SQLite each time (see "snapshot" for warm starts). Each command only
+// builds the indexes it reads.
+void benchStartup() {
+    const int n = 100000;
+    const string path = "bench_startup.db";
+    writeSampleDatabase(path, n);
+    
+    const char* const COMMANDS[][4] = {
+        { "get_photo", "42", nullptr, nullptr },
+        { "view_photo", "42", nullptr, nullptr },
+        { "search", "location", "Paris", nullptr },
+        { "search", "tag", "sunset", nullptr },
+        { "search", "prefix", "sun", nullptr },
+        { "search", "date_range", "2020-01-01,2020-12-31", nullptr },
+        { "search", "text", "beach", nullptr },
+        { "search", "description", "old town", nullptr },
+        { "get_most_recent", "10", nullptr, nullptr },
+        { "get_most_popular", "10", nullptr, nullptr },
+    };
+    const int commandCount = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+    
+    printf("%-40s %10s\n", "command", "ms");
+    for (int c = 0; c < commandCount; c++) {
+        vector<string> args;
+        args.push_back("photo_gallery");
+        string label;
+        for (int i = 0; i < 4 && COMMANDS[c][i] != nullptr; i++) {
+            args.push_back(COMMANDS[c][i]);
+            label += (i > 0 ? " " : "") + string(COMMANDS[c][i]);
+        }
+        
+        ::remove((path + ".snapshot").c_str());
+        Clock::time_point start = Clock::now();
+        {
+            PhotoGallerySystem gallery(path);
+            ostringstream out, err;
+            runCommand(gallery, args, out, err);
+        }
+        printf("%-40s %10.1f\n", label.c_str(), secondsSince(start) * 1000);
+    }
+    removeDatabase(path);
+}
+
+// Output sink that discards what is written, noting when the first byte came
+// and how many bytes there were
+class TimingSink : public streambuf {
+public:
+    Clock::time_point firstByte;
+    long long bytes;
+    
+    TimingSink() : bytes(0) {}
+
+protected:
+    int overflow(int c) override {
+        note(1);
+        return c;
+    }
+    
+    streamsize xsputn(const char*, streamsize count) override {
+        note(count);
+        return count;
+    }
+
+private:
+    void note(streamsize count) {
+        if (bytes == 0) firstByte = Clock::now();
+        bytes += count;
+    }
+};
+
+// Benchmark: listings of a 100k-photo database written as one JSON array
+// against the stream command's NDJSON chunks: total time, time until the
+// first byte reaches the reader, and peak resident memory growth while the
+// command runs
+void benchStream() {
+    const int n = 100000;
+    const string path = "bench_stream.db";
+    writeSampleDatabase(path, n);
+    PhotoGallerySystem gallery(path);
+    
+    const char* const LISTINGS[][4] = {
+        { "get_all_photos", nullptr, nullptr, nullptr },
+        { "sort", "date", "true", nullptr },
+        { "search", "tag", "sunset", nullptr },
+    };
+    const int listingCount = sizeof(LISTINGS) / sizeof(LISTINGS[0]);
+    
+    printf("%-26s %-7s %10s %12s %12s %10s\n", "listing (100k photos)", "output", "total ms", "first ms",
+           "peak +KB", "MB out");
+    for (int l = 0; l < listingCount; l++) {
+        // Streamed first, so the array's larger peak cannot hide the stream's
+        for (int streamed = 1; streamed >= 0; streamed--) {
+            vector<string> args;
+            args.push_back("photo_gallery");
+            if (streamed) args.push_back("stream");
+            string label;
+            for (int i = 0; i < 4 && LISTINGS[l][i] != nullptr; i++) {
+                args.push_back(LISTINGS[l][i]);
+                label += (i > 0 ? " " : "") + string(LISTINGS[l][i]);
+            }
+            
+            TimingSink sink;
+            ostream out(&sink);
+            ostringstream err;
+            resetPeakResident();
+            long before = residentKB();
+            Clock::time_point start = Clock::now();
+            runCommand(gallery, args, out, err);
+            double seconds = secondsSince(start);
+            long peak = residentKB("VmHWM:") - before;
+            
+            printf("%-26s %-7s %10.1f %12.1f %12ld %10.1f\n", label.c_str(), streamed ? "NDJSON" : "array",
+                   seconds * 1000, chrono::duration<double>(sink.firstByte - start).count() * 1000, peak,
+                   sink.bytes / 1e6);
+        }
+    }
+    removeDatabase(path);
+}
+
+// Benchmark: one-shot commands on a 100k-photo database, started without a
+// snapshot (load from SQLite, then write one) and with a current one. The
+// date, popularity, tag and location indexes come from snapshot sections.
+void benchSnapshot() {
+    const int n = 100000;
+    const string path = "bench_snapshot.db";
+    writeSampleDatabase(path, n);
+    
+    const char* const COMMANDS[][4] = {
+        { "get_photo", "42", nullptr, nullptr },
+        { "search", "tag", "sunset", nullptr },
+        { "search", "location", "Paris", nullptr },
+        { "search", "date_range", "2020-01-01,2020-12-31", nullptr },
+        { "get_most_popular", "10", nullptr, nullptr },
+    };
+    const int commandCount = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+    
+    printf("%-40s %12s %12s\n", "command (ms)", "no snapshot", "snapshot");
+    for (int c = 0; c < commandCount; c++) {
+        vector<string> args;
+        args.push_back("photo_gallery");
+        string label;
+        for (int i = 0; i < 4 && COMMANDS[c][i] != nullptr; i++) {
+            args.push_back(COMMANDS[c][i]);
+            label += (i > 0 ? " " : "") + string(COMMANDS[c][i]);
+        }
+        
+        double milliseconds[2];
+        for (int warm = 0; warm < 2; warm++) {
+            if (!warm) ::remove((path + ".snapshot").c_str());
+            Clock::time_point start = Clock::now();
+            {
+                PhotoGallerySystem gallery(path);
+                ostringstream out, err;
+                runCommand(gallery, args, out, err);
+            }
+            milliseconds[warm] = secondsSince(start) * 1000;
+        }
+        printf("%-40s %12.1f %12.1f\n", label.c_str(), milliseconds[0], milliseconds[1]);
+    }
+    
+    ifstream snapshot((path + ".snapshot").c_str(), ios::binary | ios::ate);
+    printf("snapshot size: %.1f MB for %d photos\n", snapshot.tellg() / 1048576.0, n);
+    removeDatabase(path);
+}
+
+// Benchmark: the same on-disk workload under each database profile. Single
+// writes pay for a sync per commit under "safe"; the bulk import and the
+// reload mostly show the effect of the journal mode, cache and mmap
+void benchProfiles() {
+    const int addCount = 500;
+    const int viewCount = 2000;
+    const int importCount = 100000;
+    const string path = "bench_profiles.db";
+    
+    vector<Photo> samples;
+    SampleRandom random;
+    for (int i = 0; i < importCount; i++) {
+        samples.push_back(makeSamplePhoto(i + 1, random));
+    }
+    
+    printf("%-10s %12s %12s %12s %10s\n", "profile", "addPhoto/s", "viewPhoto/s", "import/s", "reload s");
+    for (int p = 0; p < DATABASE_PROFILE_COUNT; p++) {
+        const char* profile = DATABASE_PROFILES[p].name;
+        double addRate, viewRate, importRate;
+        
+        removeDatabase(path);
+        {
+            PhotoGallerySystem gallery(path, profile);
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < addCount; i++) {
+                const Photo& photo = samples[i];
+                gallery.addPhoto(photo.getFilename(), photo.getLocation(), timeToString(photo.getDateTime()),
+                                 photo.getDescription(), photo.getTagsAsString(), photo.getFileSize());
+            }
+            addRate = addCount / secondsSince(start);
+            
+            start = Clock::now();
+            for (int i = 0; i < viewCount; i++) {
+                gallery.viewPhoto(1 + i % addCount);
+            }
+            viewRate = viewCount / secondsSince(start);
+            
+            vector<Photo> photos(samples.begin() + addCount, samples.end());
+            start = Clock::now();
+            int imported = gallery.importPhotos(photos);
+            importRate = imported / secondsSince(start);
+        }
+        
+        Clock::time_point start = Clock::now();
+        {
+            PhotoGallerySystem gallery(path, profile);
+        }
+        printf("%-10s %12.0f %12.0f %12.0f %10.3f\n", profile, addRate, viewRate, importRate, secondsSince(start));
+    }
+    removeDatabase(path);
+}
+
+// Benchmark: update-heavy workloads on an in-memory database, where the cost
+// of preparing SQL is not hidden behind disk syncs. The location map is built
+// first, so the writes keep it current, and the location searches at the end
+// show what it holds after them.
+void benchUpdates() {
+    const int n = 100000;
+    PhotoGallerySystem gallery(":memory:");
+    addSamplePhotos(gallery, n);
+    SampleRandom random(7);
+    
+    // The first location search scans the photo table; the second builds the map
+    vector<Photo*> results;
+    gallery.searchByLocation("Paris", results);
+    gallery.searchByLocation("Paris", results);
+    
+    printf("%-26s %12s\n", "operation (100k photos)", "ops/s");
+    
+    const int views = 500000;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < views; i++) {
+        gallery.viewPhoto(1 + random.nextInt(n));
+    }
+    printf("%-26s %12.0f\n", "viewPhoto", views / secondsSince(start));
+    
+    const int updates = 20000;
+    start = Clock::now();
+    for (int i = 0; i < updates; i++) {
+        int photoId = 1 + random.nextInt(n);
+        gallery.updatePhoto(photoId, SAMPLE_LOCATIONS[random.nextInt(SAMPLE_LOCATION_COUNT)],
+                            "edited description", "beach, sunset, family");
+    }
+    printf("%-26s %12.0f\n", "updatePhoto (3 tags)", updates / secondsSince(start));
+    
+    const int adds = 20000;
+    start = Clock::now();
+    for (int i = 0; i < adds; i++) {
+        gallery.addPhoto("new.jpg", "Paris", "2024-01-01", "new photo", "city, night", 1000);
+    }
+    printf("%-26s %12.0f\n", "addPhoto (2 tags)", adds / secondsSince(start));
+    
+    const int deletes = 20000;
+    start = Clock::now();
+    for (int i = 0; i < deletes; i++) {
+        gallery.deletePhoto(1 + random.nextInt(n));
+    }
+    printf("%-26s %12.0f\n", "deletePhoto", deletes / secondsSince(start));
+    
+    const int searches = 2000;
+    size_t hits = 0, misplaced = 0;
+    start = Clock::now();
+    for (int i = 0; i < searches; i++) {
+        const char* location = SAMPLE_LOCATIONS[i % SAMPLE_LOCATION_COUNT];
+        gallery.searchByLocation(location, results);
+        hits += results.size();
+    }
+    double searchSeconds = secondsSince(start);
+    for (int i = 0; i < SAMPLE_LOCATION_COUNT; i++) {
+        gallery.searchByLocation(SAMPLE_LOCATIONS[i], results);
+        for (size_t j = 0; j < results.size(); j++) {
+            if (results[j]->getLocation() != SAMPLE_LOCATIONS[i]) misplaced++;
+        }
+    }
+    printf("%-26s %12.0f  (%zu hits each, %zu at another location)\n", "searchByLocation",
+           searches / searchSeconds, hits / searches, misplaced);
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const Benchmark BENCHMARKS[] = {
+    { "store", benchStore },
+    { "views", benchViews },
+    { "trees", benchTrees },
+    { "load", benchLoad },
+    { "trie", benchTrie },
+    { "tags", benchTags },
+    { "text", benchText },
+    { "substring", benchSubstring },
+    { "scan", benchScan },
+    { "import", benchImport },
+    { "updates", benchUpdates },
+    { "profiles", benchProfiles },
+    { "startup", benchStartup },
+    { "snapshot", benchSnapshot },
+    { "strings", benchStrings },
+    { "columns", benchColumns },
+    { "geo", benchGeo },
+    { "locations", benchLocations },
+    { "pages", benchPages },
+    { "stream", benchStream },
+};
+const int BENCHMARK_COUNT = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+int main(int argc, char* argv[]) {
+    for (int i = 0; i < BENCHMARK_COUNT; i++) {
+        bool selected = (argc < 2);
+        for (int j = 1; j < argc; j++) {
+            if (string(argv[j]) == BENCHMARKS[i].name) selected = true;
+        }
+        if (!selected) continue;
+        
+        printf("== %s ==\n", BENCHMARKS[i].name);
+        BENCHMARKS[i].run();
+        printf("\n");
+    }
+    return 0;
+}
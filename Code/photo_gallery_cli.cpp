@@ -5,11 +5,34 @@ using namespace std;
 #include <cstring>
 #include <sqlite3.h>
 #include <sstream>
+#include <fstream>
 #include <cstdlib>
 #include <iomanip>
 #include <algorithm>
 #include <limits>
 #include <vector>
+#include <unordered_map>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <iterator>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PHOTO_GALLERY_AVX2 1
+#endif
 #include <nlohmann/json.hpp> // Include JSON library (nlohmann/json)
 
 
@@ -22,15 +45,160 @@ class PriorityQueue;
 class HashMap;
 class LinkedList;
 
+// Interned strings: every distinct value is stored once, NUL-terminated, in
+// an arena of 64 KB blocks and named by a small integer Symbol, so photos
+// and indexes hold and compare 4-byte symbols instead of strings. Lookups go
+// through an open-addressing table of symbols. Symbol 0 is the empty
+// string. Symbols are never freed: the pool grows with the number of
+// distinct values ever seen, not with the number of photos.
+typedef uint32_t Symbol;
+const Symbol NO_SYMBOL = 0xFFFFFFFF;
+
+class StringPool {
+private:
+    static const size_t BLOCK_BYTES = 64 * 1024;
+    
+    vector<char*> blocks;
+    vector<char*> largeValues;  // values too long to share a block
+    size_t usedInBlock;         // bytes handed out from blocks.back()
+    size_t arenaBytes;
+    vector<const char*> texts;  // symbol -> characters
+    vector<uint32_t> lengths;   // symbol -> length
+    vector<uint32_t> hashes;    // symbol -> hash, kept for rehashing
+    vector<Symbol> table;       // NO_SYMBOL marks an empty slot; size is a power of 2
+    
+    StringPool(const StringPool&);
+    StringPool& operator=(const StringPool&);
+    
+    static uint32_t hash(const char* text, size_t length) {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+            h = (h ^ (unsigned char)text[i]) * 16777619u;
+        }
+        return h;
+    }
+    
+    // Slot holding text, or the empty slot where it would go
+    size_t findSlot(const char* text, size_t length, uint32_t h) const {
+        size_t mask = table.size() - 1;
+        for (size_t slot = h & mask; ; slot = (slot + 1) & mask) {
+            Symbol symbol = table[slot];
+            if (symbol == NO_SYMBOL) return slot;
+            if (hashes[symbol] == h && lengths[symbol] == length && memcmp(texts[symbol], text, length) == 0) {
+                return slot;
+            }
+        }
+    }
+    
+    // Copy text into the arena; values too long for a block get their own
+    const char* copyToArena(const char* text, size_t length) {
+        size_t bytes = length + 1;
+        char* target;
+        if (bytes > BLOCK_BYTES / 4) {
+            target = static_cast<char*>(::operator new(bytes));
+            largeValues.push_back(target);
+        } else {
+            if (blocks.empty() || usedInBlock + bytes > BLOCK_BYTES) {
+                blocks.push_back(static_cast<char*>(::operator new(BLOCK_BYTES)));
+                usedInBlock = 0;
+            }
+            target = blocks.back() + usedInBlock;
+            usedInBlock += bytes;
+        }
+        memcpy(target, text, length);
+        target[length] = '\0';
+        arenaBytes += bytes;
+        return target;
+    }
+    
+    void growTable() {
+        vector<Symbol> larger(table.size() * 2, NO_SYMBOL);
+        size_t mask = larger.size() - 1;
+        for (Symbol symbol = 0; symbol < texts.size(); symbol++) {
+            size_t slot = hashes[symbol] & mask;
+            while (larger[slot] != NO_SYMBOL) slot = (slot + 1) & mask;
+            larger[slot] = symbol;
+        }
+        table.swap(larger);
+    }
+
+public:
+    StringPool() : usedInBlock(0), arenaBytes(0), table(1024, NO_SYMBOL) {
+        intern("", 0);
+    }
+    
+    ~StringPool() {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            ::operator delete(blocks[i]);
+        }
+        for (size_t i = 0; i < largeValues.size(); i++) {
+            ::operator delete(largeValues[i]);
+        }
+    }
+    
+    Symbol intern(const char* text, size_t length) {
+        uint32_t h = hash(text, length);
+        size_t slot = findSlot(text, length, h);
+        if (table[slot] != NO_SYMBOL) return table[slot];
+        
+        Symbol symbol = texts.size();
+        texts.push_back(copyToArena(text, length));
+        lengths.push_back(length);
+        hashes.push_back(h);
+        table[slot] = symbol;
+        
+        // Keep the table at most half full
+        if (texts.size() * 2 > table.size()) growTable();
+        return symbol;
+    }
+    
+    Symbol intern(const string& text) {
+        return intern(text.data(), text.length());
+    }
+    
+    // Symbol of text if it was ever interned, else NO_SYMBOL (nothing is added)
+    Symbol find(const string& text) const {
+        return table[findSlot(text.data(), text.length(), hash(text.data(), text.length()))];
+    }
+    
+    const char* c_str(Symbol symbol) const {
+        return texts[symbol];
+    }
+    
+    size_t length(Symbol symbol) const {
+        return lengths[symbol];
+    }
+    
+    string str(Symbol symbol) const {
+        return string(texts[symbol], lengths[symbol]);
+    }
+    
+    int getSymbolCount() const {
+        return texts.size();
+    }
+    
+    // Arena characters plus the per-symbol arrays and the table
+    size_t getMemoryUsage() const {
+        return arenaBytes + texts.capacity() * (sizeof(const char*) + 2 * sizeof(uint32_t)) +
+               table.capacity() * sizeof(Symbol);
+    }
+};
+
+// The pool shared by every Photo and index
+StringPool& stringPool() {
+    static StringPool pool;
+    return pool;
+}
+
 // Photo class to represent a photo with metadata
 class Photo {
 private:
     int id;
-    string filename;
-    string location;
+    Symbol filename;  // filename, location and tags are interned in stringPool()
+    Symbol location;
     time_t dateTime;
     string description;
-    string tags[10];
+    Symbol tags[10];
     int tagCount;
     int viewCount;
     int fileSize;
@@ -39,24 +207,27 @@ public:
     Photo(int id = -1, const string& filename = "", const string& location = "", 
           time_t dateTime = time(nullptr), const string& description = "", 
           int fileSize = 0, int viewCount = 0)
-        : id(id), filename(filename), location(location), dateTime(dateTime), 
+        : id(id), filename(stringPool().intern(filename)), location(stringPool().intern(location)), dateTime(dateTime), 
           description(description), fileSize(fileSize), viewCount(viewCount), tagCount(0) {}
 
     // Getters
     int getId() const { return id; }
-    string getFilename() const { return filename; }
-    string getLocation() const { return location; }
+    string getFilename() const { return stringPool().str(filename); }
+    string getLocation() const { return stringPool().str(location); }
     time_t getDateTime() const { return dateTime; }
     string getDescription() const { return description; }
-    string getTag(int index) const { return (index >= 0 && index < tagCount) ? tags[index] : ""; }
+    string getTag(int index) const { return (index >= 0 && index < tagCount) ? stringPool().str(tags[index]) : ""; }
     int getViewCount() const { return viewCount; }
     int getFileSize() const { return fileSize; }
     int getTagCount() const { return tagCount; }
+    Symbol getFilenameSymbol() const { return filename; }
+    Symbol getLocationSymbol() const { return location; }
+    Symbol getTagSymbol(int index) const { return tags[index]; }
 
     // Setters
     void setId(int id) { this->id = id; }
-    void setFilename(const string& filename) { this->filename = filename; }
-    void setLocation(const string& location) { this->location = location; }
+    void setFilename(const string& filename) { this->filename = stringPool().intern(filename); }
+    void setLocation(const string& location) { this->location = stringPool().intern(location); }
     void setDateTime(time_t dateTime) { this->dateTime = dateTime; }
     void setDescription(const string& description) { this->description = description; }
     void setViewCount(int viewCount) { this->viewCount = viewCount; }
@@ -67,20 +238,25 @@ public:
     void addTag(const string& tag) {
         if (tagCount < 10) {
             // Check if tag already exists
-            for (int i = 0; i < tagCount; i++) {
-                if (tags[i] == tag) return;
-            }
-            tags[tagCount++] = tag;
+            Symbol symbol = stringPool().intern(tag);
+            if (hasTag(symbol)) return;
+            tags[tagCount++] = symbol;
         }
     }
     
-    bool hasTag(const string& tag) const {
+    bool hasTag(Symbol tag) const {
         for (int i = 0; i < tagCount; i++) {
             if (tags[i] == tag) return true;
         }
         return false;
     }
     
+    // A tag that was never interned cannot be on any photo
+    bool hasTag(const string& tag) const {
+        Symbol symbol = stringPool().find(tag);
+        return symbol != NO_SYMBOL && hasTag(symbol);
+    }
+    
     void setTags(const string& tagsStr) {
         tagCount = 0;
         string tag;
@@ -90,7 +266,7 @@ public:
             tag.erase(0, tag.find_first_not_of(" \t\n\r\f\v"));
             tag.erase(tag.find_last_not_of(" \t\n\r\f\v") + 1);
             if (!tag.empty()) {
-                tags[tagCount++] = tag;
+                tags[tagCount++] = stringPool().intern(tag);
             }
         }
     }
@@ -99,37 +275,251 @@ public:
         string result;
         for (int i = 0; i < tagCount; i++) {
             if (i > 0) result += ", ";
-            result += tags[i];
+            result.append(stringPool().c_str(tags[i]), stringPool().length(tags[i]));
         }
         return result;
     }
 };
 
+// Photo store: owns every Photo by value in fixed-size chunks. A PhotoHandle
+// is a slot number; neither the handle nor the Photo* it resolves to moves
+// when the store grows, so the data structures below can keep pointers into it.
+typedef int PhotoHandle;
+const PhotoHandle NO_PHOTO = -1;
+
+class PhotoStore {
+private:
+    static const int CHUNK_BITS = 12;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;  // 4096 photos per chunk
+    
+    vector<Photo*> chunks;          // raw storage for CHUNK_SIZE photos each
+    vector<unsigned char> live;     // 1 if the slot holds a constructed Photo
+    vector<PhotoHandle> freeSlots;  // slots released by remove(), reused first
+    int liveCount;
+    
+    Photo* slot(PhotoHandle handle) const {
+        return chunks[handle >> CHUNK_BITS] + (handle & (CHUNK_SIZE - 1));
+    }
+
+public:
+    PhotoStore() : liveCount(0) {}
+    
+    ~PhotoStore() {
+        clear();
+        for (size_t i = 0; i < chunks.size(); i++) {
+            ::operator delete(chunks[i]);
+        }
+    }
+    
+    PhotoStore(const PhotoStore&) = delete;
+    PhotoStore& operator=(const PhotoStore&) = delete;
+    
+    PhotoHandle add(const Photo& photo) {
+        PhotoHandle handle;
+        if (!freeSlots.empty()) {
+            handle = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            handle = live.size();
+            if ((handle >> CHUNK_BITS) == (int)chunks.size()) {
+                chunks.push_back(static_cast<Photo*>(::operator new(sizeof(Photo) * CHUNK_SIZE)));
+            }
+            live.push_back(0);
+        }
+        
+        new (slot(handle)) Photo(photo);
+        live[handle] = 1;
+        liveCount++;
+        return handle;
+    }
+    
+    void remove(PhotoHandle handle) {
+        if (!isLive(handle)) return;
+        
+        slot(handle)->~Photo();
+        live[handle] = 0;
+        freeSlots.push_back(handle);
+        liveCount--;
+    }
+    
+    bool isLive(PhotoHandle handle) const {
+        return handle >= 0 && handle < (int)live.size() && live[handle];
+    }
+    
+    Photo* get(PhotoHandle handle) const {
+        return isLive(handle) ? slot(handle) : nullptr;
+    }
+    
+    // Number of live photos
+    int size() const {
+        return liveCount;
+    }
+    
+    // Every handle ever returned is below this; scans walk [0, slotCount())
+    int slotCount() const {
+        return live.size();
+    }
+    
+    // Visit every live photo in slot order, walking each chunk sequentially
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+        int slots = live.size();
+        for (int base = 0; base < slots; base += CHUNK_SIZE) {
+            Photo* chunk = chunks[base >> CHUNK_BITS];
+            int end = min((int)CHUNK_SIZE, slots - base);
+            for (int i = 0; i < end; i++) {
+                if (live[base + i]) visit(chunk[i]);
+            }
+        }
+    }
+    
+    void reserve(int count) {
+        live.reserve(count);
+        chunks.reserve((count + CHUNK_SIZE - 1) >> CHUNK_BITS);
+    }
+    
+    // Destroy all photos but keep the chunks for reuse
+    void clear() {
+        for (PhotoHandle h = 0; h < (int)live.size(); h++) {
+            if (live[h]) slot(h)->~Photo();
+        }
+        live.clear();
+        freeSlots.clear();
+        liveCount = 0;
+    }
+};
+
+// Node pool: hands out nodes of one type from 64 KB blocks and recycles freed
+// nodes through a free list, so building a structure costs one allocation per
+// block instead of one per node. clear() drops every node at once.
+template <typename T>
+class NodePool {
+private:
+    union Slot {
+        Slot* next;
+        typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+    
+    static const int BLOCK_BYTES = 64 * 1024;
+    static const int NODES_PER_BLOCK = (BLOCK_BYTES / sizeof(Slot) > 0) ? BLOCK_BYTES / sizeof(Slot) : 1;
+    
+    vector<Slot*> blocks;
+    Slot* freeList;    // nodes given back by destroy()
+    int usedInBlock;   // slots handed out from blocks.back()
+    int liveCount;
+    
+    Slot* takeSlot() {
+        if (freeList != nullptr) {
+            Slot* slot = freeList;
+            freeList = slot->next;
+            return slot;
+        }
+        if (blocks.empty() || usedInBlock == NODES_PER_BLOCK) {
+            blocks.push_back(static_cast<Slot*>(::operator new(sizeof(Slot) * NODES_PER_BLOCK)));
+            usedInBlock = 0;
+        }
+        return &blocks.back()[usedInBlock++];
+    }
+    
+    void releaseBlocks() {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            ::operator delete(blocks[i]);
+        }
+        blocks.clear();
+        freeList = nullptr;
+        usedInBlock = 0;
+        liveCount = 0;
+    }
+
+public:
+    NodePool() : freeList(nullptr), usedInBlock(0), liveCount(0) {}
+    
+    // Nodes still alive are not destroyed; owners with non-trivial nodes
+    // destroy() them first
+    ~NodePool() {
+        releaseBlocks();
+    }
+    
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+    
+    template <typename... Args>
+    T* create(Args&&... args) {
+        Slot* slot = takeSlot();
+        liveCount++;
+        return new (&slot->storage) T(std::forward<Args>(args)...);
+    }
+    
+    void destroy(T* node) {
+        node->~T();
+        Slot* slot = reinterpret_cast<Slot*>(node);
+        slot->next = freeList;
+        freeList = slot;
+        liveCount--;
+    }
+    
+    // Free every node without visiting them
+    void clear() {
+        static_assert(is_trivially_destructible<T>::value, "clear() would skip node destructors");
+        releaseBlocks();
+    }
+    
+    int getLiveCount() const {
+        return liveCount;
+    }
+    
+    int getBlockCount() const {
+        return blocks.size();
+    }
+};
+
 // 1. AVL Tree implementation for balanced binary search tree
+// Nodes hold only the sort key (an ID, a date, a size or a view count), the
+// photo's ID, which orders photos with equal keys, and its store handle; the
+// Photo itself lives once in the PhotoStore. Each
+// node also counts the nodes in its subtree, which makes the tree an
+// order-statistic tree: the k-th entry and the position of an entry are
+// found in O(log n), so a page of a sorted listing costs O(log n + page).
 class AVLNode {
 public:
-    Photo photo;
+    long long key;
+    int photoId;
+    PhotoHandle handle;
+    int height;
+    int size;  // nodes in this subtree, itself included
     AVLNode* left;
     AVLNode* right;
-    int height;
     
-    AVLNode(const Photo& p) : photo(p), left(nullptr), right(nullptr), height(1) {}
+    AVLNode(long long key, int photoId, PhotoHandle handle)
+        : key(key), photoId(photoId), handle(handle), height(1), size(1), left(nullptr), right(nullptr) {}
 };
 
 class AVLTree {
 private:
     AVLNode* root;
+    NodePool<AVLNode> nodes;
     
     int height(AVLNode* node) {
         if (node == nullptr) return 0;
         return node->height;
     }
     
+    int size(AVLNode* node) {
+        if (node == nullptr) return 0;
+        return node->size;
+    }
+    
     int getBalance(AVLNode* node) {
         if (node == nullptr) return 0;
         return height(node->left) - height(node->right);
     }
     
+    // Recompute a node's height and size from its children
+    void update(AVLNode* node) {
+        node->height = max(height(node->left), height(node->right)) + 1;
+        node->size = size(node->left) + size(node->right) + 1;
+    }
+    
     AVLNode* rightRotate(AVLNode* y) {
         AVLNode* x = y->left;
         AVLNode* T2 = x->right;
@@ -137,8 +527,8 @@ private:
         x->right = y;
         y->left = T2;
         
-        y->height = max(height(y->left), height(y->right)) + 1;
-        x->height = max(height(x->left), height(x->right)) + 1;
+        update(y);
+        update(x);
         
         return x;
     }
@@ -150,506 +540,1364 @@ private:
         y->left = x;
         x->right = T2;
         
-        x->height = max(height(x->left), height(x->right)) + 1;
-        y->height = max(height(y->left), height(y->right)) + 1;
+        update(x);
+        update(y);
         
         return y;
     }
     
-    AVLNode* insert(AVLNode* node, const Photo& photo, bool byDate) {
-        // Standard BST insert
-        if (node == nullptr)
-            return new AVLNode(photo);
-            
-        bool shouldGoLeft;
-        if (byDate) {
-            shouldGoLeft = difftime(photo.getDateTime(), node->photo.getDateTime()) < 0;
-        } else {
-            shouldGoLeft = photo.getViewCount() < node->photo.getViewCount();
-        }
-        
-        if (shouldGoLeft)
-            node->left = insert(node->left, photo, byDate);
-        else
-            node->right = insert(node->right, photo, byDate);
-            
-        // Update height
-        node->height = 1 + max(height(node->left), height(node->right));
-        
-        // Get balance factor
+    // Tree order: key, with the photo ID breaking ties so that every photo
+    // has exactly one position, can be found again by remove(), and keeps
+    // it across processes (store handles are reused, IDs are not)
+    static bool comesBefore(long long keyA, int photoIdA, long long keyB, int photoIdB) {
+        if (keyA != keyB) return keyA < keyB;
+        return photoIdA < photoIdB;
+    }
+    
+    // Restore the AVL property at node after one of its subtrees changed height
+    AVLNode* rebalance(AVLNode* node) {
+        update(node);
         int balance = getBalance(node);
         
-        // Left Left Case
-        if (balance > 1 && ((byDate && difftime(photo.getDateTime(), node->left->photo.getDateTime()) < 0) || 
-                            (!byDate && photo.getViewCount() < node->left->photo.getViewCount()))) {
+        // Left Left / Left Right
+        if (balance > 1) {
+            if (getBalance(node->left) < 0)
+                node->left = leftRotate(node->left);
             return rightRotate(node);
         }
         
-        // Right Right Case
-        if (balance < -1 && ((byDate && difftime(photo.getDateTime(), node->right->photo.getDateTime()) >= 0) || 
-                             (!byDate && photo.getViewCount() >= node->right->photo.getViewCount()))) {
+        // Right Right / Right Left
+        if (balance < -1) {
+            if (getBalance(node->right) > 0)
+                node->right = rightRotate(node->right);
             return leftRotate(node);
         }
         
-        // Left Right Case
-        if (balance > 1 && ((byDate && difftime(photo.getDateTime(), node->left->photo.getDateTime()) >= 0) || 
-                            (!byDate && photo.getViewCount() >= node->left->photo.getViewCount()))) {
-            node->left = leftRotate(node->left);
-            return rightRotate(node);
-        }
+        return node;
+    }
+    
+    AVLNode* insert(AVLNode* node, long long key, int photoId, PhotoHandle handle) {
+        // Standard BST insert
+        if (node == nullptr)
+            return nodes.create(key, photoId, handle);
+            
+        if (comesBefore(key, photoId, node->key, node->photoId))
+            node->left = insert(node->left, key, photoId, handle);
+        else
+            node->right = insert(node->right, key, photoId, handle);
+            
+        return rebalance(node);
+    }
+    
+    AVLNode* minValueNode(AVLNode* node) {
+        while (node->left != nullptr)
+            node = node->left;
+        return node;
+    }
+    
+    AVLNode* remove(AVLNode* node, long long key, int photoId, bool& removed) {
+        if (node == nullptr)
+            return nullptr;
         
-        // Right Left Case
-        if (balance < -1 && ((byDate && difftime(photo.getDateTime(), node->right->photo.getDateTime()) < 0) || 
-                             (!byDate && photo.getViewCount() < node->right->photo.getViewCount()))) {
-            node->right = rightRotate(node->right);
-            return leftRotate(node);
+        if (key == node->key && photoId == node->photoId) {
+            removed = true;
+            
+            if (node->left == nullptr || node->right == nullptr) {
+                AVLNode* child = node->left ? node->left : node->right;
+                nodes.destroy(node);
+                return child;
+            }
+            
+            // Two children: take over the in-order successor's entry
+            AVLNode* successor = minValueNode(node->right);
+            node->key = successor->key;
+            node->photoId = successor->photoId;
+            node->handle = successor->handle;
+            bool removedSuccessor = false;
+            node->right = remove(node->right, node->key, node->photoId, removedSuccessor);
+        } else if (comesBefore(key, photoId, node->key, node->photoId)) {
+            node->left = remove(node->left, key, photoId, removed);
+        } else {
+            node->right = remove(node->right, key, photoId, removed);
         }
         
+        return rebalance(node);
+    }
+    
+    template <typename KeyOf, typename IdOf>
+    AVLNode* buildBalanced(const PhotoHandle* handles, int low, int high, KeyOf keyOf, IdOf idOf) {
+        if (low > high) return nullptr;
+        
+        int mid = low + (high - low) / 2;
+        AVLNode* node = nodes.create(keyOf(handles[mid]), idOf(handles[mid]), handles[mid]);
+        node->left = buildBalanced(handles, low, mid - 1, keyOf, idOf);
+        node->right = buildBalanced(handles, mid + 1, high, keyOf, idOf);
+        update(node);
         return node;
     }
     
-    void inOrderTraversal(AVLNode* node, Photo*& photos, int& index) {
+    void inOrderTraversal(AVLNode* node, vector<PhotoHandle>& handles) {
         if (node != nullptr) {
-            inOrderTraversal(node->left, photos, index);
-            photos[index++] = node->photo;
-            inOrderTraversal(node->right, photos, index);
+            inOrderTraversal(node->left, handles);
+            handles.push_back(node->handle);
+            inOrderTraversal(node->right, handles);
         }
     }
     
-    void reverseInOrderTraversal(AVLNode* node, Photo*& photos, int& index) {
+    void reverseInOrderTraversal(AVLNode* node, vector<PhotoHandle>& handles) {
         if (node != nullptr) {
-            reverseInOrderTraversal(node->right, photos, index);
-            photos[index++] = node->photo;
-            reverseInOrderTraversal(node->left, photos, index);
+            reverseInOrderTraversal(node->right, handles);
+            handles.push_back(node->handle);
+            reverseInOrderTraversal(node->left, handles);
         }
     }
     
-    void clearTree(AVLNode* node) {
-        if (node != nullptr) {
-            clearTree(node->left);
-            clearTree(node->right);
-            delete node;
+    // Append up to remaining handles in tree order (reverse order if not
+    // ascending) after passing over the first skip of them. Subtrees that lie
+    // wholly inside the skipped part are passed over by their size, so only
+    // one root-to-leaf path is walked before the first handle is appended.
+    void collectRange(AVLNode* node, int& skip, int& remaining, bool ascending, vector<PhotoHandle>& handles) {
+        if (node == nullptr || remaining == 0) return;
+        AVLNode* before = ascending ? node->left : node->right;
+        AVLNode* after = ascending ? node->right : node->left;
+        
+        if (skip >= size(before)) {
+            skip -= size(before);
+        } else {
+            collectRange(before, skip, remaining, ascending, handles);
+            if (remaining == 0) return;
+        }
+        
+        if (skip > 0) {
+            skip--;
+        } else {
+            handles.push_back(node->handle);
+            remaining--;
         }
+        collectRange(after, skip, remaining, ascending, handles);
     }
     
-    // For date range search
-    void searchDateRange(AVLNode* node, time_t start, time_t end, Photo** results, int& count) {
+    // For date range search: collect handles with start <= key <= end
+    void searchKeyRange(AVLNode* node, long long start, long long end, vector<PhotoHandle>& results) {
         if (node == nullptr) return;
         
         // If current node is in range, check left subtree
-        if (difftime(node->photo.getDateTime(), start) >= 0) {
-            searchDateRange(node->left, start, end, results, count);
+        if (node->key >= start) {
+            searchKeyRange(node->left, start, end, results);
         }
         
         // Include current node if in range
-        if (difftime(node->photo.getDateTime(), start) >= 0 && 
-            difftime(end, node->photo.getDateTime()) >= 0) {
-            results[count++] = new Photo(node->photo);
+        if (node->key >= start && node->key <= end) {
+            results.push_back(node->handle);
         }
         
         // If current node is in range, check right subtree
-        if (difftime(end, node->photo.getDateTime()) >= 0) {
-            searchDateRange(node->right, start, end, results, count);
+        if (node->key <= end) {
+            searchKeyRange(node->right, start, end, results);
         }
     }
     
 public:
     AVLTree() : root(nullptr) {}
     
-    ~AVLTree() {
-        clearTree(root);
+    AVLTree(const AVLTree&) = delete;
+    AVLTree& operator=(const AVLTree&) = delete;
+    
+    void insert(long long key, int photoId, PhotoHandle handle) {
+        root = insert(root, key, photoId, handle);
     }
     
-    void insert(const Photo& photo, bool byDate = true) {
-        root = insert(root, photo, byDate);
+    // Returns false if no node has this key and photo ID. The key must be the
+    // one the photo was inserted with (e.g. its view count before a view).
+    bool remove(long long key, int photoId) {
+        bool removed = false;
+        root = remove(root, key, photoId, removed);
+        return removed;
     }
     
-    void getSortedPhotos(Photo* photos, bool ascending = true) {
-        int index = 0;
+    void getSortedHandles(vector<PhotoHandle>& handles, bool ascending = true) {
+        handles.clear();
         if (ascending) {
-            inOrderTraversal(root, photos, index);
+            inOrderTraversal(root, handles);
         } else {
-            reverseInOrderTraversal(root, photos, index);
+            reverseInOrderTraversal(root, handles);
         }
     }
     
-    Photo** searchByDateRange(time_t start, time_t end, int& count) {
-        Photo** results = new Photo*[100]; // Assuming max 100 photos
-        count = 0;
-        searchDateRange(root, start, end, results, count);
-        return results;
+    // Handles of up to limit entries (all the rest if limit is negative)
+    // starting at position offset of the ascending or descending order
+    void getRange(int offset, int limit, bool ascending, vector<PhotoHandle>& handles) {
+        handles.clear();
+        int skip = max(offset, 0);
+        int remaining = limit < 0 ? max(size(root) - skip, 0) : min(limit, max(size(root) - skip, 0));
+        handles.reserve(remaining);
+        collectRange(root, skip, remaining, ascending, handles);
     }
     
-    void rebuild(Photo** photos, int count, bool byDate = true) {
-        clearTree(root);
-        root = nullptr;
-        for (int i = 0; i < count; i++) {
-            insert(*photos[i], byDate);
+    // Handle of the entry at position k of the ascending order, or NO_PHOTO
+    // if k is out of range
+    PhotoHandle select(int k) {
+        if (k < 0 || k >= size(root)) return NO_PHOTO;
+        AVLNode* node = root;
+        while (true) {
+            int leftSize = size(node->left);
+            if (k < leftSize) {
+                node = node->left;
+            } else if (k == leftSize) {
+                return node->handle;
+            } else {
+                k -= leftSize + 1;
+                node = node->right;
+            }
         }
     }
     
-    int getSize(AVLNode* node) {
-        if (node == nullptr) return 0;
-        return 1 + getSize(node->left) + getSize(node->right);
+    // Number of entries that come before (key, photoId) in tree order,
+    // whether or not the tree holds it; with no photo ID (IDs are positive),
+    // the number of entries whose key is less than key
+    int rank(long long key, int photoId = -1) {
+        int before = 0;
+        AVLNode* node = root;
+        while (node != nullptr) {
+            if (comesBefore(node->key, node->photoId, key, photoId)) {
+                before += size(node->left) + 1;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return before;
+    }
+    
+    void searchByKeyRange(long long start, long long end, vector<PhotoHandle>& results) {
+        results.clear();
+        searchKeyRange(root, start, end, results);
+    }
+    
+    // Replace the contents with handles that are already in tree order
+    // (keyOf(handle) ascending, ties by idOf(handle)), building a perfectly
+    // balanced tree in O(n) instead of n rebalancing inserts
+    template <typename KeyOf, typename IdOf>
+    void buildSorted(const PhotoHandle* handles, int count, KeyOf keyOf, IdOf idOf) {
+        clear();
+        root = buildBalanced(handles, 0, count - 1, keyOf, idOf);
+    }
+    
+    void clear() {
+        nodes.clear();
+        root = nullptr;
     }
     
     int getSize() {
-        return getSize(root);
+        return size(root);
     }
 };
 
-// 2. Trie implementation for prefix searching
-class TrieNode {
-public:
-    TrieNode* children[36]; // a-z and 0-9
-    bool isEndOfWord;
-    int photoIds[100];  // Store photo IDs that contain this tag/word
-    int photoCount;
+// Sorted posting list helpers: photo IDs kept in increasing order without
+// duplicates. IDs usually arrive in increasing order, which makes insertion
+// an append.
+bool insertSortedId(vector<int>& ids, int photoId) {
+    if (ids.empty() || ids.back() < photoId) {
+        ids.push_back(photoId);
+        return true;
+    }
+    vector<int>::iterator pos = lower_bound(ids.begin(), ids.end(), photoId);
+    if (pos != ids.end() && *pos == photoId) return false;
+    ids.insert(pos, photoId);
+    return true;
+}
+
+bool eraseSortedId(vector<int>& ids, int photoId) {
+    vector<int>::iterator pos = lower_bound(ids.begin(), ids.end(), photoId);
+    if (pos == ids.end() || *pos != photoId) return false;
+    ids.erase(pos);
+    return true;
+}
+
+// Posting list set operations. Each takes two sorted, unique lists and
+// writes a sorted, unique result.
+
+// Below this size ratio the lists are merged; above it every ID of the short
+// list is galloped for in the long one, so "rare AND common" costs
+// O(short * log(long / short)) instead of a pass over the common tag
+const size_t GALLOP_RATIO = 32;
+
+// First index at or after from whose ID is >= target: doubles the step until
+// it overshoots, then binary searches the last step
+size_t gallopTo(const vector<int>& ids, size_t from, int target) {
+    size_t low = from, high = from, step = 1;
+    while (high < ids.size() && ids[high] < target) {
+        low = high + 1;
+        high += step;
+        step *= 2;
+    }
+    if (high > ids.size()) high = ids.size();
+    return lower_bound(ids.begin() + low, ids.begin() + high, target) - ids.begin();
+}
+
+void intersectSortedIds(const vector<int>& a, const vector<int>& b, vector<int>& result) {
+    result.clear();
+    if (a.size() > b.size()) {
+        intersectSortedIds(b, a, result);
+        return;
+    }
+    if (a.empty()) return;
+    result.reserve(a.size());
     
-    TrieNode() : isEndOfWord(false), photoCount(0) {
-        for (int i = 0; i < 36; i++)
-            children[i] = nullptr;
+    if (b.size() / a.size() >= GALLOP_RATIO) {
+        size_t j = 0;
+        for (size_t i = 0; i < a.size() && j < b.size(); i++) {
+            j = gallopTo(b, j, a[i]);
+            if (j < b.size() && b[j] == a[i]) result.push_back(a[i]);
+        }
+        return;
+    }
+    
+    const int* pa = a.data();
+    const int* pb = b.data();
+    size_t i = 0, j = 0;
+#ifdef __SSE2__
+    // Compare 4 IDs of a against all 4 rotations of 4 IDs of b at once, keep
+    // the lanes of a that matched, and advance whichever block ends lower
+    while (i + 4 <= a.size() && j + 4 <= b.size()) {
+        __m128i blockA = _mm_loadu_si128((const __m128i*)(pa + i));
+        __m128i blockB = _mm_loadu_si128((const __m128i*)(pb + j));
+        __m128i equal = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(blockA, blockB),
+                         _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+        while (mask != 0) {
+            int lane = __builtin_ctz(mask);
+            result.push_back(pa[i + lane]);
+            mask &= mask - 1;
+        }
+        
+        int lastA = pa[i + 3];
+        int lastB = pb[j + 3];
+        if (lastA <= lastB) i += 4;
+        if (lastB <= lastA) j += 4;
+    }
+#endif
+    while (i < a.size() && j < b.size()) {
+        if (pa[i] < pb[j]) {
+            i++;
+        } else if (pb[j] < pa[i]) {
+            j++;
+        } else {
+            result.push_back(pa[i]);
+            i++;
+            j++;
+        }
     }
+}
+
+void unionSortedIds(const vector<int>& a, const vector<int>& b, vector<int>& result) {
+    result.clear();
+    result.reserve(a.size() + b.size());
+    set_union(a.begin(), a.end(), b.begin(), b.end(), back_inserter(result));
+}
+
+// IDs of a that are not in b
+void subtractSortedIds(const vector<int>& a, const vector<int>& b, vector<int>& result) {
+    result.clear();
+    result.reserve(a.size());
     
-    ~TrieNode() {
-        for (int i = 0; i < 36; i++) {
-            if (children[i])
-                delete children[i];
+    if (!a.empty() && b.size() / a.size() >= GALLOP_RATIO) {
+        size_t j = 0;
+        for (size_t i = 0; i < a.size(); i++) {
+            j = gallopTo(b, j, a[i]);
+            if (j == b.size() || b[j] != a[i]) result.push_back(a[i]);
         }
+        return;
     }
+    set_difference(a.begin(), a.end(), b.begin(), b.end(), back_inserter(result));
+}
+
+// 2. Trie implementation for prefix searching
+// All nodes live in one vector and keep their children as a sibling chain
+// sorted by label, so a node is 16 bytes whatever its fan-out. Photo IDs for
+// a word are held out of line in a sorted, growable posting list.
+struct TrieNode {
+    int firstChild;   // index of the first child, -1 if none
+    int nextSibling;  // next child of the same parent (larger label), -1 if last
+    int postingList;  // index into postingLists if a word ends here, else -1
+    char label;
+    
+    TrieNode(char label) : firstChild(-1), nextSibling(-1), postingList(-1), label(label) {}
 };
 
 class Trie {
 private:
-    TrieNode* root;
+    vector<TrieNode> nodes;          // nodes[0] is the root
+    vector<vector<int> > postingLists;
     
-    // Convert character to index (a-z, 0-9)
-    int charToIndex(char c) {
+    // Fold to the indexed alphabet (a-z, 0-9); 0 means skip the character
+    static char normalize(char c) {
         if (c >= 'a' && c <= 'z')
-            return c - 'a';
+            return c;
         if (c >= 'A' && c <= 'Z')
-            return c - 'A';
+            return c - 'A' + 'a';
         if (c >= '0' && c <= '9')
-            return c - '0' + 26;
-        return -1; // Invalid character
-    }
-    
-    void searchPrefix(TrieNode* node, const string& prefix, int* photoIds, int& count) {
-        if (node->isEndOfWord) {
-            for (int i = 0; i < node->photoCount; i++) {
-                bool exists = false;
-                for (int j = 0; j < count; j++) {
-                    if (photoIds[j] == node->photoIds[i]) {
-                        exists = true;
-                        break;
-                    }
-                }
-                if (!exists) {
-                    photoIds[count++] = node->photoIds[i];
-                }
-            }
+            return c;
+        return 0; // Invalid character
+    }
+    
+    int findChild(int node, char label) const {
+        for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling) {
+            if (nodes[child].label == label) return child;
+            if (nodes[child].label > label) break;
+        }
+        return -1;
+    }
+    
+    int findOrAddChild(int node, char label) {
+        int prev = -1;
+        int child = nodes[node].firstChild;
+        while (child != -1 && nodes[child].label < label) {
+            prev = child;
+            child = nodes[child].nextSibling;
         }
+        if (child != -1 && nodes[child].label == label) return child;
         
-        for (int i = 0; i < 36; i++) {
-            if (node->children[i]) {
-                searchPrefix(node->children[i], prefix, photoIds, count);
-            }
+        int added = nodes.size();
+        nodes.push_back(TrieNode(label));
+        nodes[added].nextSibling = child;
+        if (prev == -1) {
+            nodes[node].firstChild = added;
+        } else {
+            nodes[prev].nextSibling = added;
         }
+        return added;
     }
     
-public:
-    Trie() {
-        root = new TrieNode();
+    // Node reached by the normalized key, -1 if there is none
+    int findNode(const string& key) const {
+        int node = 0;
+        for (size_t i = 0; i < key.length() && node != -1; i++) {
+            char label = normalize(key[i]);
+            if (label == 0) continue; // Skip invalid characters
+            node = findChild(node, label);
+        }
+        return node;
+    }
+    
+    void collectPostingLists(int node, vector<const vector<int>*>& lists) const {
+        if (nodes[node].postingList != -1) {
+            lists.push_back(&postingLists[nodes[node].postingList]);
+        }
+        for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling) {
+            collectPostingLists(child, lists);
+        }
     }
     
-    ~Trie() {
-        delete root;
+public:
+    Trie() {
+        nodes.push_back(TrieNode(0));
     }
     
     void insert(const string& key, int photoId) {
-        TrieNode* node = root;
-        
+        int node = 0;
         for (size_t i = 0; i < key.length(); i++) {
-            int index = charToIndex(key[i]);
-            if (index == -1) continue; // Skip invalid characters
-            
-            if (!node->children[index])
-                node->children[index] = new TrieNode();
-                
-            node = node->children[index];
+            char label = normalize(key[i]);
+            if (label == 0) continue; // Skip invalid characters
+            node = findOrAddChild(node, label);
         }
         
-        // Mark last node as leaf and add photo ID
-        node->isEndOfWord = true;
-        
-        // Add photo ID if not already present
-        bool exists = false;
-        for (int i = 0; i < node->photoCount; i++) {
-            if (node->photoIds[i] == photoId) {
-                exists = true;
-                break;
-            }
+        if (nodes[node].postingList == -1) {
+            nodes[node].postingList = postingLists.size();
+            postingLists.push_back(vector<int>());
         }
         
-        if (!exists && node->photoCount < 100) {
-            node->photoIds[node->photoCount++] = photoId;
+        insertSortedId(postingLists[nodes[node].postingList], photoId);
+    }
+    
+    // Drop one photo from a word's posting list (the node stays)
+    void remove(const string& key, int photoId) {
+        int node = findNode(key);
+        if (node != -1 && nodes[node].postingList != -1) {
+            eraseSortedId(postingLists[nodes[node].postingList], photoId);
         }
     }
     
-    int* searchByPrefix(const string& prefix, int& count) {
-        TrieNode* node = root;
-        int* photoIds = new int[100]; // Assuming max 100 photos
-        count = 0;
-        
-        // Navigate to the end of prefix
-        for (size_t i = 0; i < prefix.length(); i++) {
-            int index = charToIndex(prefix[i]);
-            if (index == -1) continue; // Skip invalid characters
-            
-            if (!node->children[index])
-                return photoIds; // Prefix not found
-                
-            node = node->children[index];
+    // Posting list of exactly this word, nullptr if no photo has it
+    const vector<int>* find(const string& key) const {
+        int node = findNode(key);
+        if (node == -1 || nodes[node].postingList == -1) return nullptr;
+        return &postingLists[nodes[node].postingList];
+    }
+    
+    // Sorted, unique IDs of every word starting with prefix
+    void searchByPrefix(const string& prefix, vector<int>& photoIds) const {
+        photoIds.clear();
+        int node = findNode(prefix);
+        if (node == -1) return; // Prefix not found
+        
+        vector<const vector<int>*> lists;
+        collectPostingLists(node, lists);
+        if (lists.size() == 1) {
+            photoIds = *lists[0];
+            return;
         }
         
-        // Find all words with the given prefix
-        searchPrefix(node, prefix, photoIds, count);
-        return photoIds;
+        for (size_t i = 0; i < lists.size(); i++) {
+            photoIds.insert(photoIds.end(), lists[i]->begin(), lists[i]->end());
+        }
+        sort(photoIds.begin(), photoIds.end());
+        photoIds.erase(unique(photoIds.begin(), photoIds.end()), photoIds.end());
+    }
+    
+    int getNodeCount() const {
+        return nodes.size();
+    }
+    
+    // Approximate heap footprint: node array plus posting lists
+    size_t getMemoryUsage() const {
+        size_t bytes = nodes.capacity() * sizeof(TrieNode) + postingLists.capacity() * sizeof(vector<int>);
+        for (size_t i = 0; i < postingLists.size(); i++) {
+            bytes += postingLists[i].capacity() * sizeof(int);
+        }
+        return bytes;
     }
 };
 
-// 3. Priority Queue (Max Heap) implementation for recent/popular photos
-class PriorityQueue {
+// Tag index: exact tag -> sorted posting list of photo IDs, so a tag query
+// costs a hash lookup plus the hits instead of a scan over every photo.
+// Tags are keyed by their interned symbol.
+class TagIndex {
 private:
-    Photo* heap[100];  // Max heap
-    int size;
-    bool byViewCount;  // Whether to prioritize by view count or date
+    unordered_map<Symbol, vector<int> > postings;
+
+public:
+    void add(Symbol tag, int photoId) {
+        insertSortedId(postings[tag], photoId);
+    }
     
-    void heapifyUp(int index) {
-        int parent = (index - 1) / 2;
-        while (index > 0) {
-            bool shouldSwap;
-            if (byViewCount) {
-                shouldSwap = heap[index]->getViewCount() > heap[parent]->getViewCount();
+    void add(const string& tag, int photoId) {
+        add(stringPool().intern(tag), photoId);
+    }
+    
+    void remove(Symbol tag, int photoId) {
+        unordered_map<Symbol, vector<int> >::iterator it = postings.find(tag);
+        if (it == postings.end()) return;
+        
+        eraseSortedId(it->second, photoId);
+        if (it->second.empty()) {
+            postings.erase(it);
+        }
+    }
+    
+    void addPhoto(const Photo& photo) {
+        for (int i = 0; i < photo.getTagCount(); i++) {
+            add(photo.getTagSymbol(i), photo.getId());
+        }
+    }
+    
+    void removePhoto(const Photo& photo) {
+        for (int i = 0; i < photo.getTagCount(); i++) {
+            remove(photo.getTagSymbol(i), photo.getId());
+        }
+    }
+    
+    // Set a tag's whole posting list at once; ids must be sorted and unique
+    void setPostings(Symbol tag, const int* ids, size_t count) {
+        postings[tag].assign(ids, ids + count);
+    }
+    
+    // Posting list for tag, nullptr if no photo has it
+    const vector<int>* find(const string& tag) const {
+        unordered_map<Symbol, vector<int> >::const_iterator it = postings.find(stringPool().find(tag));
+        return it == postings.end() ? nullptr : &it->second;
+    }
+    
+    int getTagCount() const {
+        return postings.size();
+    }
+};
+
+// Boolean tag query such as "beach AND sunset NOT people" or
+// "(city OR night) food". AND binds tighter than OR, adjacent terms are
+// ANDed, NOT negates the term after it and keywords are case-insensitive.
+// Every other word is an exact tag; tags containing spaces or keywords can
+// be double-quoted. The query is parsed once into a node array and then
+// evaluated over TagIndex posting lists.
+class TagQuery {
+private:
+    struct QueryToken {
+        string text;
+        bool quoted;
+    };
+    
+    // Leaves hold a tag, groups AND or OR their children (sibling-chained
+    // like TrieNode)
+    struct QueryNode {
+        string tag;
+        bool isGroup;
+        bool isOr;
+        bool negated;
+        int firstChild;
+        int nextSibling;
+    };
+    
+    vector<QueryToken> tokens;
+    size_t nextToken;
+    vector<QueryNode> nodes;
+    int root;
+    string error;
+    
+    // Set for the duration of evaluate()
+    const TagIndex* index;
+    const vector<int>* allIds;
+    
+    static bool isKeyword(const QueryToken& token, const char* keyword) {
+        if (token.quoted || token.text.length() != strlen(keyword)) return false;
+        for (size_t i = 0; i < token.text.length(); i++) {
+            if (toupper((unsigned char)token.text[i]) != keyword[i]) return false;
+        }
+        return true;
+    }
+    
+    static bool isSymbol(const QueryToken& token, const char* symbol) {
+        return !token.quoted && token.text == symbol;
+    }
+    
+    void tokenize(const string& query) {
+        tokens.clear();
+        QueryToken current = { "", false };
+        for (size_t i = 0; i <= query.length(); i++) {
+            char c = i < query.length() ? query[i] : ' ';
+            if (c == '"') {
+                size_t close = query.find('"', i + 1);
+                if (close == string::npos) close = query.length();
+                QueryToken quoted = { query.substr(i + 1, close - i - 1), true };
+                tokens.push_back(quoted);
+                i = close;
+            } else if (isspace((unsigned char)c) || c == '(' || c == ')') {
+                if (!current.text.empty()) {
+                    tokens.push_back(current);
+                    current.text.clear();
+                }
+                if (c == '(' || c == ')') {
+                    QueryToken paren = { string(1, c), false };
+                    tokens.push_back(paren);
+                }
             } else {
-                shouldSwap = difftime(heap[index]->getDateTime(), heap[parent]->getDateTime()) > 0;
+                current.text += c;
             }
-            
-            if (shouldSwap) {
-                swap(heap[index], heap[parent]);
-                index = parent;
-                parent = (index - 1) / 2;
-            } else {
-                break;
+        }
+    }
+    
+    int addNode(const string& tag, bool isGroup, bool isOr) {
+        QueryNode node = { tag, isGroup, isOr, false, -1, -1 };
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+    
+    // orExpr := andExpr (OR andExpr)*
+    int parseOr() {
+        int first = parseAnd();
+        if (first == -1) return -1;
+        if (nextToken == tokens.size() || !isKeyword(tokens[nextToken], "OR")) return first;
+        
+        int group = addNode("", true, true);
+        nodes[group].firstChild = first;
+        int last = first;
+        while (nextToken < tokens.size() && isKeyword(tokens[nextToken], "OR")) {
+            nextToken++;
+            int operand = parseAnd();
+            if (operand == -1) return -1;
+            nodes[last].nextSibling = operand;
+            last = operand;
+        }
+        return group;
+    }
+    
+    // andExpr := unary ([AND] unary)*
+    int parseAnd() {
+        int first = parseUnary();
+        if (first == -1) return -1;
+        
+        int group = -1;
+        int last = first;
+        while (nextToken < tokens.size() && !isKeyword(tokens[nextToken], "OR") &&
+               !isSymbol(tokens[nextToken], ")")) {
+            if (isKeyword(tokens[nextToken], "AND")) nextToken++;
+            int operand = parseUnary();
+            if (operand == -1) return -1;
+            if (group == -1) {
+                group = addNode("", true, false);
+                nodes[group].firstChild = first;
             }
+            nodes[last].nextSibling = operand;
+            last = operand;
         }
+        return group == -1 ? first : group;
     }
     
-    void heapifyDown(int index) {
-        int maxIndex = index;
-        int left = 2 * index + 1;
-        int right = 2 * index + 2;
+    // unary := NOT unary | "(" orExpr ")" | tag
+    int parseUnary() {
+        if (nextToken == tokens.size()) {
+            error = "Expected a tag at the end of the query";
+            return -1;
+        }
         
-        if (byViewCount) {
-            if (left < size && heap[left]->getViewCount() > heap[maxIndex]->getViewCount())
-                maxIndex = left;
-            
-            if (right < size && heap[right]->getViewCount() > heap[maxIndex]->getViewCount())
-                maxIndex = right;
+        const QueryToken& token = tokens[nextToken++];
+        if (isKeyword(token, "NOT")) {
+            int operand = parseUnary();
+            if (operand != -1) nodes[operand].negated = !nodes[operand].negated;
+            return operand;
+        }
+        if (isSymbol(token, "(")) {
+            int inner = parseOr();
+            if (inner == -1) return -1;
+            if (nextToken == tokens.size() || !isSymbol(tokens[nextToken], ")")) {
+                error = "Missing )";
+                return -1;
+            }
+            nextToken++;
+            return inner;
+        }
+        if (isSymbol(token, ")") || isKeyword(token, "AND") || isKeyword(token, "OR")) {
+            error = "Unexpected '" + token.text + "'";
+            return -1;
+        }
+        return addNode(token.text, false, false);
+    }
+    
+    // A negated term that is not ANDed with a positive one, or an AND of
+    // only negated terms, is evaluated against every photo ID
+    bool usesAllIds(int node, bool standalone) const {
+        if (nodes[node].negated && standalone) return true;
+        if (!nodes[node].isGroup) return false;
+        
+        bool hasPositive = false;
+        for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling) {
+            if (!nodes[child].negated) hasPositive = true;
+            if (usesAllIds(child, nodes[node].isOr)) return true;
+        }
+        return !nodes[node].isOr && !hasPositive;
+    }
+    
+    // Matches of a node ignoring its negation. Leaves return their posting
+    // list without copying; groups are evaluated into storage.
+    const vector<int>* positiveIds(int node, vector<int>& storage) const {
+        static const vector<int> noIds;
+        if (nodes[node].isGroup) {
+            evaluateGroup(node, storage);
+            return &storage;
+        }
+        const vector<int>* ids = index->find(nodes[node].tag);
+        return ids == nullptr ? &noIds : ids;
+    }
+    
+    void evaluateNode(int node, vector<int>& photoIds) const {
+        vector<int> storage;
+        const vector<int>* ids = positiveIds(node, storage);
+        if (nodes[node].negated) {
+            subtractSortedIds(*allIds, *ids, photoIds);
+        } else if (ids == &storage) {
+            photoIds.swap(storage);
         } else {
-            if (left < size && difftime(heap[left]->getDateTime(), heap[maxIndex]->getDateTime()) > 0)
-                maxIndex = left;
+            photoIds = *ids;
+        }
+    }
+    
+    void evaluateGroup(int node, vector<int>& photoIds) const {
+        int childCount = 0;
+        for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling) {
+            childCount++;
+        }
+        vector<vector<int> > storage(childCount);
+        vector<int> merged;
+        
+        if (nodes[node].isOr) {
+            photoIds.clear();
+            int i = 0;
+            for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling, i++) {
+                const vector<int>* ids = &storage[i];
+                if (nodes[child].negated) {
+                    evaluateNode(child, storage[i]);
+                } else {
+                    ids = positiveIds(child, storage[i]);
+                }
+                unionSortedIds(photoIds, *ids, merged);
+                photoIds.swap(merged);
+            }
+            return;
+        }
+        
+        // AND: intersect the positive terms shortest list first, so every
+        // step is bounded by the smallest result so far, then subtract the
+        // negated ones
+        vector<const vector<int>*> included, excluded;
+        int i = 0;
+        for (int child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling, i++) {
+            const vector<int>* ids = positiveIds(child, storage[i]);
+            (nodes[child].negated ? excluded : included).push_back(ids);
+        }
+        sort(included.begin(), included.end(), [](const vector<int>* a, const vector<int>* b) {
+            return a->size() < b->size();
+        });
+        
+        if (included.empty()) {
+            photoIds = *allIds;
+        } else if (included.size() == 1) {
+            photoIds = *included[0];
+        } else {
+            intersectSortedIds(*included[0], *included[1], photoIds);
+        }
+        for (size_t k = 2; k < included.size() && !photoIds.empty(); k++) {
+            intersectSortedIds(photoIds, *included[k], merged);
+            photoIds.swap(merged);
+        }
+        for (size_t k = 0; k < excluded.size() && !photoIds.empty(); k++) {
+            subtractSortedIds(photoIds, *excluded[k], merged);
+            photoIds.swap(merged);
+        }
+    }
+
+public:
+    TagQuery() : nextToken(0), root(-1), index(nullptr), allIds(nullptr) {}
+    
+    // Parse a query; on failure getError() says why
+    bool parse(const string& query) {
+        nodes.clear();
+        error.clear();
+        tokenize(query);
+        nextToken = 0;
+        
+        if (tokens.empty()) {
+            error = "Empty tag query";
+            return false;
+        }
+        
+        root = parseOr();
+        if (root != -1 && nextToken < tokens.size()) {
+            error = "Unexpected '" + tokens[nextToken].text + "'";
+            root = -1;
+        }
+        return root != -1;
+    }
+    
+    const string& getError() const {
+        return error;
+    }
+    
+    // Whether evaluate() needs the sorted list of every photo ID (only for
+    // NOT terms with nothing positive to subtract them from)
+    bool needsAllIds() const {
+        return root != -1 && usesAllIds(root, true);
+    }
+    
+    // Sorted IDs of the photos matching a parsed query
+    void evaluate(const TagIndex& tagIndex, const vector<int>& everyId, vector<int>& photoIds) {
+        photoIds.clear();
+        if (root == -1) return;
+        
+        index = &tagIndex;
+        allIds = &everyId;
+        evaluateNode(root, photoIds);
+        index = nullptr;
+        allIds = nullptr;
+    }
+};
+
+// Full-text index over photo descriptions. Every lowercase word (a run of
+// letters and digits) maps to the sorted IDs of the photos using it, held in
+// a Trie so prefix terms walk the same structure. A query is an AND of words,
+// prefixes ("sun*") and phrases ("\"old town\"", or "new-york", which splits
+// into two words). A phrase is answered by intersecting its words and then
+// checking word order on the remaining candidates only.
+class TextIndex {
+private:
+    Trie words;
+    
+    // Whether text contains phrase as consecutive words. Works on word
+    // offsets into text (spans is reused across calls) rather than copying
+    // each word out.
+    static bool containsPhrase(const string& text, const vector<string>& phrase,
+                               vector<pair<size_t, size_t> >& spans) {
+        spans.clear();
+        for (size_t i = 0; i < text.length(); ) {
+            if (!isalnum((unsigned char)text[i])) {
+                i++;
+                continue;
+            }
+            size_t start = i;
+            while (i < text.length() && isalnum((unsigned char)text[i])) i++;
+            spans.push_back(make_pair(start, i - start));
+        }
+        
+        for (size_t first = 0; first + phrase.size() <= spans.size(); first++) {
+            size_t k = 0;
+            while (k < phrase.size() && spans[first + k].second == phrase[k].length()) {
+                const char* word = text.data() + spans[first + k].first;
+                size_t c = 0;
+                while (c < phrase[k].length() && tolower((unsigned char)word[c]) == phrase[k][c]) c++;
+                if (c < phrase[k].length()) break;
+                k++;
+            }
+            if (k == phrase.size()) return true;
+        }
+        return false;
+    }
+
+public:
+    // Lowercase words of text, in order
+    static void tokenize(const string& text, vector<string>& tokens) {
+        tokens.clear();
+        string word;
+        for (size_t i = 0; i <= text.length(); i++) {
+            unsigned char c = i < text.length() ? text[i] : ' ';
+            if (isalnum(c)) {
+                word += tolower(c);
+            } else if (!word.empty()) {
+                tokens.push_back(word);
+                word.clear();
+            }
+        }
+    }
+    
+    void addPhoto(const Photo& photo) {
+        vector<string> tokens;
+        tokenize(photo.getDescription(), tokens);
+        for (size_t i = 0; i < tokens.size(); i++) {
+            words.insert(tokens[i], photo.getId());
+        }
+    }
+    
+    void removePhoto(const Photo& photo) {
+        vector<string> tokens;
+        tokenize(photo.getDescription(), tokens);
+        for (size_t i = 0; i < tokens.size(); i++) {
+            words.remove(tokens[i], photo.getId());
+        }
+    }
+    
+    // Sorted IDs of the photos matching every term of query. photoById
+    // resolves a candidate ID to its Photo for the phrase check.
+    template <typename Lookup>
+    void search(const string& query, Lookup photoById, vector<int>& photoIds) const {
+        photoIds.clear();
+        
+        // Split the query into terms: quoted phrases and whitespace-separated words
+        vector<string> terms;
+        vector<bool> quoted;
+        for (size_t i = 0; i < query.length(); ) {
+            if (query[i] == '"') {
+                size_t close = query.find('"', i + 1);
+                if (close == string::npos) close = query.length();
+                terms.push_back(query.substr(i + 1, close - i - 1));
+                quoted.push_back(true);
+                i = close + 1;
+            } else if (isspace((unsigned char)query[i])) {
+                i++;
+            } else {
+                size_t end = i;
+                while (end < query.length() && !isspace((unsigned char)query[end]) && query[end] != '"') end++;
+                terms.push_back(query.substr(i, end - i));
+                quoted.push_back(false);
+                i = end;
+            }
+        }
+        
+        // One posting list per word or prefix; prefix lists are computed into
+        // prefixIds, reserved up front so the pointers stay valid
+        vector<const vector<int>*> lists;
+        vector<vector<int> > prefixIds;
+        prefixIds.reserve(terms.size());
+        vector<vector<string> > phrases;
+        vector<string> tokens;
+        
+        for (size_t t = 0; t < terms.size(); t++) {
+            bool isPrefix = !quoted[t] && terms[t][terms[t].length() - 1] == '*';
+            tokenize(terms[t], tokens);
+            if (tokens.empty()) continue;
             
-            if (right < size && difftime(heap[right]->getDateTime(), heap[maxIndex]->getDateTime()) > 0)
-                maxIndex = right;
+            for (size_t k = 0; k < tokens.size(); k++) {
+                if (isPrefix && k + 1 == tokens.size()) {
+                    prefixIds.push_back(vector<int>());
+                    words.searchByPrefix(tokens[k], prefixIds.back());
+                    lists.push_back(&prefixIds.back());
+                } else {
+                    const vector<int>* ids = words.find(tokens[k]);
+                    if (ids == nullptr) return;
+                    lists.push_back(ids);
+                }
+            }
+            if (tokens.size() > 1 && !isPrefix) {
+                phrases.push_back(tokens);
+            }
+        }
+        if (lists.empty()) return;
+        
+        // Intersect shortest list first
+        sort(lists.begin(), lists.end(), [](const vector<int>* a, const vector<int>* b) {
+            return a->size() < b->size();
+        });
+        photoIds = *lists[0];
+        vector<int> merged;
+        for (size_t k = 1; k < lists.size() && !photoIds.empty(); k++) {
+            intersectSortedIds(photoIds, *lists[k], merged);
+            photoIds.swap(merged);
         }
         
-        if (index != maxIndex) {
-            swap(heap[index], heap[maxIndex]);
-            heapifyDown(maxIndex);
+        if (phrases.empty()) return;
+        vector<pair<size_t, size_t> > spans;
+        size_t kept = 0;
+        for (size_t i = 0; i < photoIds.size(); i++) {
+            const Photo* photo = photoById(photoIds[i]);
+            if (photo == nullptr) continue;
+            
+            string description = photo->getDescription();
+            bool matches = true;
+            for (size_t k = 0; k < phrases.size() && matches; k++) {
+                matches = containsPhrase(description, phrases[k], spans);
+            }
+            if (matches) photoIds[kept++] = photoIds[i];
+        }
+        photoIds.resize(kept);
+    }
+    
+    int getWordNodeCount() const {
+        return words.getNodeCount();
+    }
+};
+
+// 3. Priority Queue (Max Heap) implementation for recent/popular photos
+// Indexed heap: position[] maps a photo ID to its slot in the heap, so a photo
+// whose view count changed can be moved up or down in O(log n) with update()
+// instead of rebuilding the whole queue.
+class PriorityQueue {
+private:
+    vector<Photo*> heap;  // Max heap
+    vector<int> position; // photo ID -> index in heap, -1 if not queued
+    bool byViewCount;     // Whether to prioritize by view count or date
+    
+    bool higherPriority(const Photo* a, const Photo* b) const {
+        if (byViewCount) {
+            return a->getViewCount() > b->getViewCount();
+        }
+        return difftime(a->getDateTime(), b->getDateTime()) > 0;
+    }
+    
+    void place(int index, Photo* photo) {
+        heap[index] = photo;
+        position[photo->getId()] = index;
+    }
+    
+    int positionOf(const Photo* photo) const {
+        int id = photo->getId();
+        return (id >= 0 && id < (int)position.size()) ? position[id] : -1;
+    }
+    
+    void heapifyUp(int index) {
+        Photo* photo = heap[index];
+        while (index > 0) {
+            int parent = (index - 1) / 2;
+            if (!higherPriority(photo, heap[parent])) break;
+            place(index, heap[parent]);
+            index = parent;
+        }
+        place(index, photo);
+    }
+    
+    void heapifyDown(int index) {
+        Photo* photo = heap[index];
+        int size = heap.size();
+        while (true) {
+            int maxIndex = index;
+            Photo* maxPhoto = photo;
+            int left = 2 * index + 1;
+            int right = 2 * index + 2;
+            
+            if (left < size && higherPriority(heap[left], maxPhoto)) {
+                maxIndex = left;
+                maxPhoto = heap[left];
+            }
+            if (right < size && higherPriority(heap[right], maxPhoto)) {
+                maxIndex = right;
+                maxPhoto = heap[right];
+            }
+            
+            if (maxIndex == index) break;
+            place(index, maxPhoto);
+            index = maxIndex;
         }
+        place(index, photo);
     }
     
+    void removeAt(int index) {
+        position[heap[index]->getId()] = -1;
+        Photo* last = heap.back();
+        heap.pop_back();
+        
+        if (index < (int)heap.size()) {
+            place(index, last);
+            heapifyUp(index);
+            heapifyDown(position[last->getId()]);
+        }
+    }
+
 public:
-    PriorityQueue(bool byViewCount = false) : size(0), byViewCount(byViewCount) {}
+    PriorityQueue(bool byViewCount = false) : byViewCount(byViewCount) {}
     
+    // Add a photo; a photo that is already queued is repositioned instead
     void insert(Photo* photo) {
-        if (size >= 100) return; // Heap is full
+        if (contains(photo)) {
+            update(photo);
+            return;
+        }
         
-        heap[size] = photo;
-        heapifyUp(size);
-        size++;
+        if (photo->getId() >= (int)position.size()) {
+            position.resize(photo->getId() + 1, -1);
+        }
+        heap.push_back(photo);
+        heapifyUp(heap.size() - 1);
+    }
+    
+    // Restore heap order after this photo's priority went up or down
+    void update(Photo* photo) {
+        int index = positionOf(photo);
+        if (index < 0) return;
+        
+        heapifyUp(index);
+        heapifyDown(position[photo->getId()]);
+    }
+    
+    void remove(const Photo* photo) {
+        int index = positionOf(photo);
+        if (index >= 0) {
+            removeAt(index);
+        }
+    }
+    
+    bool contains(const Photo* photo) const {
+        return positionOf(photo) >= 0;
     }
     
     Photo* extractMax() {
-        if (size == 0) return nullptr;
+        if (heap.empty()) return nullptr;
         
         Photo* result = heap[0];
-        heap[0] = heap[size - 1];
-        size--;
-        heapifyDown(0);
-        
+        removeAt(0);
         return result;
     }
     
     Photo* peek() {
-        return (size > 0) ? heap[0] : nullptr;
+        return heap.empty() ? nullptr : heap[0];
     }
     
     bool isEmpty() {
-        return size == 0;
+        return heap.empty();
     }
     
     int getSize() {
-        return size;
+        return heap.size();
     }
     
     void clear() {
-        size = 0;
+        heap.clear();
+        position.clear();
     }
     
-    Photo** getAll(int& count) {
-        Photo** result = new Photo*[size];
-        count = size;
-        
-        // Create a copy of the heap
-        PriorityQueue tempQueue(byViewCount);
-        for (int i = 0; i < size; i++) {
-            tempQueue.insert(heap[i]);
-        }
-        
-        // Extract all elements
-        for (int i = 0; i < count; i++) {
-            result[i] = tempQueue.extractMax();
+    // The k highest-priority photos in order, without modifying the queue.
+    // A small frontier heap over heap indices visits O(k log k) entries.
+    void getTop(int k, vector<Photo*>& result) {
+        result.clear();
+        if (k <= 0 || heap.empty()) return;
+        
+        auto lower = [this](int a, int b) { return higherPriority(heap[b], heap[a]); };
+        vector<int> frontier(1, 0);
+        while (!frontier.empty() && (int)result.size() < k) {
+            pop_heap(frontier.begin(), frontier.end(), lower);
+            int index = frontier.back();
+            frontier.pop_back();
+            result.push_back(heap[index]);
+            
+            for (int child = 2 * index + 1; child <= 2 * index + 2; child++) {
+                if (child < (int)heap.size()) {
+                    frontier.push_back(child);
+                    push_heap(frontier.begin(), frontier.end(), lower);
+                }
+            }
         }
-        
-        return result;
     }
-};
-
-// 4. Hash Map implementation for location-based search
-class HashMapNode {
-public:
-    string key;
-    int photoIds[100];
-    int count;
-    HashMapNode* next;
     
-    HashMapNode(const string& k, int photoId) : key(k), count(1), next(nullptr) {
-        photoIds[0] = photoId;
+    void getAll(vector<Photo*>& result) {
+        getTop(heap.size(), result);
     }
 };
 
+// 4. Hash Map implementation for location-based search: an open-addressing
+// table with Robin Hood probing, keyed by interned location. Slots hold the
+// key, its distance from its home slot and the index of its posting list, so
+// a probe walks 12-byte slots instead of nodes. An insert takes the slot of
+// any key that is closer to home than the one being placed, which keeps
+// probe lengths short and even; a lookup can stop as soon as it passes a
+// key closer to home than its own would be. Removal shifts the following
+// run back one slot instead of leaving tombstones. The table doubles when it
+// is 3/4 full. Posting lists are sorted, duplicate-free and unbounded.
 class HashMap {
 private:
-    static const int TABLE_SIZE = 101;
-    HashMapNode* table[TABLE_SIZE];
+    struct Slot {
+        Symbol key;         // NO_SYMBOL when empty
+        uint32_t distance;  // probes from the key's home slot
+        int posting;        // index into postings
+    };
     
-    int hashFunction(const string& key) {
-        int hash = 0;
-        for (char c : key) {
-            hash = (hash * 31 + c) % TABLE_SIZE;
-        }
-        return hash;
+    vector<Slot> slots;  // size is a power of two
+    vector<vector<int> > postings;
+    vector<int> freePostings;  // posting lists of removed keys, reused first
+    int keyCount;
+    
+    // Symbols are small consecutive integers, so they are mixed before
+    // being masked to a slot (the lowbias32 finalizer)
+    static uint32_t hash(Symbol key) {
+        uint32_t x = key;
+        x ^= x >> 16;
+        x *= 0x7feb352dU;
+        x ^= x >> 15;
+        x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
     }
     
-public:
-    HashMap() {
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            table[i] = nullptr;
-        }
+    size_t mask() const {
+        return slots.size() - 1;
     }
     
-    ~HashMap() {
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            HashMapNode* current = table[i];
-            while (current != nullptr) {
-                HashMapNode* next = current->next;
-                delete current;
-                current = next;
-            }
+    // Slot holding key, or -1
+    long findSlot(Symbol key) const {
+        if (key == NO_SYMBOL) return -1;
+        
+        size_t index = hash(key) & mask();
+        for (uint32_t distance = 0;; distance++, index = (index + 1) & mask()) {
+            const Slot& slot = slots[index];
+            if (slot.key == NO_SYMBOL || slot.distance < distance) return -1;
+            if (slot.key == key) return index;
         }
     }
     
-    void insert(const string& key, int photoId) {
-        int index = hashFunction(key);
-        
-        // Check if key already exists
-        HashMapNode* current = table[index];
-        while (current != nullptr) {
-            if (current->key == key) {
-                // Check if photo ID already exists
-                for (int i = 0; i < current->count; i++) {
-                    if (current->photoIds[i] == photoId) {
-                        return; // Photo ID already exists
-                    }
-                }
-                
-                // Add photo ID
-                if (current->count < 100) {
-                    current->photoIds[current->count++] = photoId;
-                }
+    // Place a key that is not in the table, displacing richer keys
+    void place(Slot entry) {
+        size_t index = hash(entry.key) & mask();
+        entry.distance = 0;
+        for (;; entry.distance++, index = (index + 1) & mask()) {
+            Slot& slot = slots[index];
+            if (slot.key == NO_SYMBOL) {
+                slot = entry;
                 return;
             }
-            current = current->next;
+            if (slot.distance < entry.distance) {
+                swap(slot, entry);
+            }
         }
-        
-        // Create new node
-        HashMapNode* newNode = new HashMapNode(key, photoId);
-        newNode->next = table[index];
-        table[index] = newNode;
     }
     
-    int* get(const string& key, int& count) {
-        int index = hashFunction(key);
-        HashMapNode* current = table[index];
-        
-        while (current != nullptr) {
-            if (current->key == key) {
-                count = current->count;
-                int* result = new int[count];
-                for (int i = 0; i < count; i++) {
-                    result[i] = current->photoIds[i];
-                }
-                return result;
-            }
-            current = current->next;
+    void grow() {
+        vector<Slot> old(slots.size() * 2, emptySlot());
+        old.swap(slots);
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i].key != NO_SYMBOL) place(old[i]);
         }
-        
-        count = 0;
-        return new int[0];
     }
     
-    void remove(const string& key) {
-        int index = hashFunction(key);
-        HashMapNode* current = table[index];
-        HashMapNode* prev = nullptr;
+    static Slot emptySlot() {
+        Slot slot = { NO_SYMBOL, 0, -1 };
+        return slot;
+    }
+    
+    // Posting list for key, adding the key if needed
+    vector<int>& postingsFor(Symbol key) {
+        long index = findSlot(key);
+        if (index >= 0) return postings[slots[index].posting];
         
-        while (current != nullptr) {
-            if (current->key == key) {
-                if (prev == nullptr) {
-                    table[index] = current->next;
-                } else {
-                    prev->next = current->next;
-                }
-                delete current;
-                return;
-            }
-            prev = current;
-            current = current->next;
+        if ((keyCount + 1) * 4 > (long)slots.size() * 3) grow();
+        
+        Slot entry = { key, 0, (int)postings.size() };
+        if (!freePostings.empty()) {
+            entry.posting = freePostings.back();
+            freePostings.pop_back();
+        } else {
+            postings.push_back(vector<int>());
         }
+        place(entry);
+        keyCount++;
+        return postings[entry.posting];
     }
     
-    void getAllKeys(string* keys, int& count) {
-        count = 0;
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            HashMapNode* current = table[i];
-            while (current != nullptr) {
-                keys[count++] = current->key;
-                current = current->next;
-            }
+    // Empty a slot and shift the run after it back by one
+    void removeSlot(size_t index) {
+        vector<int>().swap(postings[slots[index].posting]);
+        freePostings.push_back(slots[index].posting);
+        keyCount--;
+        
+        size_t next = (index + 1) & mask();
+        while (slots[next].key != NO_SYMBOL && slots[next].distance > 0) {
+            slots[index] = slots[next];
+            slots[index].distance--;
+            index = next;
+            next = (next + 1) & mask();
+        }
+        slots[index] = emptySlot();
+    }
+
+public:
+    HashMap() : slots(16, emptySlot()), keyCount(0) {}
+    
+    void insert(Symbol key, int photoId) {
+        insertSortedId(postingsFor(key), photoId);
+    }
+    
+    // Remove one photo from a key, and the key once no photo has it
+    void remove(Symbol key, int photoId) {
+        long index = findSlot(key);
+        if (index < 0) return;
+        
+        vector<int>& photoIds = postings[slots[index].posting];
+        eraseSortedId(photoIds, photoId);
+        if (photoIds.empty()) removeSlot(index);
+    }
+    
+    // Move a photo from one key to another
+    void move(int photoId, Symbol from, Symbol to) {
+        if (from == to) return;
+        remove(from, photoId);
+        insert(to, photoId);
+    }
+    
+    // Set a key's whole posting list at once; ids must be sorted and unique
+    void setPostings(Symbol key, const int* ids, size_t count) {
+        postingsFor(key).assign(ids, ids + count);
+    }
+    
+    // Posting list for a location, nullptr if no photo has it
+    const vector<int>* find(Symbol key) const {
+        long index = findSlot(key);
+        return index < 0 ? nullptr : &postings[slots[index].posting];
+    }
+    
+    const vector<int>* find(const string& keyText) const {
+        return find(stringPool().find(keyText));
+    }
+    
+    void getAllKeys(vector<string>& keys) {
+        keys.clear();
+        keys.reserve(keyCount);
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].key != NO_SYMBOL) keys.push_back(stringPool().str(slots[i].key));
         }
     }
+    
+    int getKeyCount() const {
+        return keyCount;
+    }
+    
+    int getCapacity() const {
+        return slots.size();
+    }
 };
 
 // 5. Linked List implementation for sequential operations
@@ -666,21 +1914,24 @@ private:
     ListNode* head;
     ListNode* tail;
     int size;
+    NodePool<ListNode> nodes;
     
 public:
     LinkedList() : head(nullptr), tail(nullptr), size(0) {}
     
     ~LinkedList() {
-        ListNode* current = head;
-        while (current != nullptr) {
-            ListNode* next = current->next;
-            delete current; // Note: we don't delete the photo as it may be referenced elsewhere
-            current = next;
-        }
+        clear();
+    }
+    
+    void clear() {
+        nodes.clear(); // Note: we don't delete the photos as they may be referenced elsewhere
+        head = nullptr;
+        tail = nullptr;
+        size = 0;
     }
     
     void append(Photo* photo) {
-        ListNode* newNode = new ListNode(photo);
+        ListNode* newNode = nodes.create(photo);
         if (head == nullptr) {
             head = newNode;
             tail = newNode;
@@ -692,7 +1943,7 @@ public:
     }
     
     void insertAtBeginning(Photo* photo) {
-        ListNode* newNode = new ListNode(photo);
+        ListNode* newNode = nodes.create(photo);
         if (head == nullptr) {
             head = newNode;
             tail = newNode;
@@ -713,6 +1964,26 @@ public:
         return current->photo;
     }
     
+    // Unlink the node holding this photo, if any
+    void remove(const Photo* photo) {
+        ListNode* prev = nullptr;
+        ListNode* current = head;
+        while (current != nullptr && current->photo != photo) {
+            prev = current;
+            current = current->next;
+        }
+        if (current == nullptr) return;
+        
+        if (prev == nullptr) {
+            head = current->next;
+        } else {
+            prev->next = current->next;
+        }
+        if (current == tail) tail = prev;
+        nodes.destroy(current);
+        size--;
+    }
+    
     void removeAt(int index) {
         if (index < 0 || index >= size) return;
         
@@ -720,7 +1991,7 @@ public:
             ListNode* temp = head;
             head = head->next;
             if (head == nullptr) tail = nullptr;
-            delete temp;
+            nodes.destroy(temp);
         } else {
             ListNode* current = head;
             for (int i = 0; i < index - 1; i++) {
@@ -729,7 +2000,7 @@ public:
             ListNode* temp = current->next;
             current->next = temp->next;
             if (temp == tail) tail = current;
-            delete temp;
+            nodes.destroy(temp);
         }
         size--;
     }
@@ -748,6 +2019,197 @@ public:
     }
 };
 
+// Parse a "lat, lon" location in decimal degrees, the form the GUI stores
+// for photos with GPS metadata. Anything else, including coordinates out of
+// range, is not a coordinate pair.
+bool parseCoordinates(const char* text, double& latitude, double& longitude) {
+    char* end;
+    latitude = strtod(text, &end);
+    if (end == text) return false;
+    
+    const char* p = end;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p++ != ',') return false;
+    
+    longitude = strtod(p, &end);
+    if (end == p) return false;
+    while (isspace((unsigned char)*end)) end++;
+    return *end == '\0' && fabs(latitude) <= 90 && fabs(longitude) <= 180;  // also rejects nan
+}
+
+const double EARTH_RADIUS_KM = 6371.0088;
+const double RADIANS_PER_DEGREE = 3.14159265358979323846 / 180;
+
+// Great-circle distance between two points in degrees (haversine)
+double distanceKm(double lat1, double lon1, double lat2, double lon2) {
+    double dLat = (lat2 - lat1) * RADIANS_PER_DEGREE;
+    double dLon = (lon2 - lon1) * RADIANS_PER_DEGREE;
+    double a = sin(dLat / 2) * sin(dLat / 2) +
+               cos(lat1 * RADIANS_PER_DEGREE) * cos(lat2 * RADIANS_PER_DEGREE) * sin(dLon / 2) * sin(dLon / 2);
+    return 2 * EARTH_RADIUS_KM * asin(min(1.0, sqrt(a)));
+}
+
+// Geospatial index over photos whose location is a coordinate pair. Points
+// are bucketed into the cells of a fixed latitude/longitude grid, and each
+// non-empty cell is a hash map entry holding its points, so a radius or box
+// query only looks at the cells it overlaps. A query overlapping more grid
+// cells than there are non-empty ones walks the non-empty cells instead.
+class GeoIndex {
+private:
+    static const int CELLS_PER_DEGREE = 100;  // 0.01 degree cells, about 1.1 km of latitude
+    static const int LAT_CELLS = 180 * CELLS_PER_DEGREE;
+    static const int LON_CELLS = 360 * CELLS_PER_DEGREE;
+    
+    struct GeoPoint {
+        int photoId;
+        double latitude;
+        double longitude;
+    };
+    
+    unordered_map<long long, vector<GeoPoint>> cells;
+    int pointCount;
+    
+    static int latCell(double latitude) {
+        return max(0, min(LAT_CELLS - 1, (int)floor((latitude + 90) * CELLS_PER_DEGREE)));
+    }
+    
+    static int lonCell(double longitude) {
+        return max(0, min(LON_CELLS - 1, (int)floor((longitude + 180) * CELLS_PER_DEGREE)));
+    }
+    
+    static long long cellKey(int latIndex, int lonIndex) {
+        return (long long)latIndex * LON_CELLS + lonIndex;
+    }
+    
+    // Visit the points in latitude cells [latLow, latHigh] and longitude
+    // cells lonLow to lonHigh going east, wrapping at the antimeridian
+    template <typename Visitor>
+    void forEachCandidate(int latLow, int latHigh, int lonLow, int lonHigh, Visitor visit) const {
+        int lonSpan = (lonHigh - lonLow + LON_CELLS) % LON_CELLS + 1;
+        
+        if ((long long)(latHigh - latLow + 1) * lonSpan > (long long)cells.size()) {
+            for (auto it = cells.begin(); it != cells.end(); ++it) {
+                int latIndex = it->first / LON_CELLS;
+                int lonOffset = (it->first % LON_CELLS - lonLow + LON_CELLS) % LON_CELLS;
+                if (latIndex < latLow || latIndex > latHigh || lonOffset >= lonSpan) continue;
+                for (size_t i = 0; i < it->second.size(); i++) visit(it->second[i]);
+            }
+            return;
+        }
+        
+        for (int latIndex = latLow; latIndex <= latHigh; latIndex++) {
+            for (int offset = 0; offset < lonSpan; offset++) {
+                auto it = cells.find(cellKey(latIndex, (lonLow + offset) % LON_CELLS));
+                if (it == cells.end()) continue;
+                for (size_t i = 0; i < it->second.size(); i++) visit(it->second[i]);
+            }
+        }
+    }
+
+public:
+    GeoIndex() : pointCount(0) {}
+    
+    // Index a photo if its location is a coordinate pair
+    void addPhoto(const Photo& photo) {
+        double latitude, longitude;
+        if (!parseCoordinates(stringPool().c_str(photo.getLocationSymbol()), latitude, longitude)) return;
+        
+        GeoPoint point = { photo.getId(), latitude, longitude };
+        cells[cellKey(latCell(latitude), lonCell(longitude))].push_back(point);
+        pointCount++;
+    }
+    
+    void removePhoto(const Photo& photo) {
+        double latitude, longitude;
+        if (!parseCoordinates(stringPool().c_str(photo.getLocationSymbol()), latitude, longitude)) return;
+        
+        auto it = cells.find(cellKey(latCell(latitude), lonCell(longitude)));
+        if (it == cells.end()) return;
+        vector<GeoPoint>& points = it->second;
+        for (size_t i = 0; i < points.size(); i++) {
+            if (points[i].photoId != photo.getId()) continue;
+            points[i] = points.back();
+            points.pop_back();
+            pointCount--;
+            break;
+        }
+        if (points.empty()) cells.erase(it);
+    }
+    
+    // IDs of the photos within radiusKm of a point, nearest first
+    void searchNear(double latitude, double longitude, double radiusKm, vector<int>& photoIds) const {
+        photoIds.clear();
+        
+        // Bounding box of the circle: its latitude span is exact, and the
+        // longitude span is the widest the circle gets, unless it reaches
+        // a pole, where every longitude is in range
+        double angle = radiusKm / EARTH_RADIUS_KM;
+        double latSpan = angle / RADIANS_PER_DEGREE;
+        double minLat = latitude - latSpan;
+        double maxLat = latitude + latSpan;
+        double lonSpan = 180;
+        if (minLat > -90 && maxLat < 90) {
+            lonSpan = asin(min(1.0, sin(angle) / cos(latitude * RADIANS_PER_DEGREE))) / RADIANS_PER_DEGREE;
+        }
+        
+        int lonLow = 0, lonHigh = LON_CELLS - 1;
+        if (lonSpan < 180 - 1.0 / CELLS_PER_DEGREE) {
+            double west = longitude - lonSpan, east = longitude + lonSpan;
+            lonLow = lonCell(west < -180 ? west + 360 : west);
+            lonHigh = lonCell(east > 180 ? east - 360 : east);
+        }
+        
+        vector<pair<double, int>> matches;
+        forEachCandidate(latCell(max(minLat, -90.0)), latCell(min(maxLat, 90.0)), lonLow, lonHigh,
+                         [&](const GeoPoint& point) {
+            if (point.latitude < minLat || point.latitude > maxLat) return;
+            double distance = distanceKm(latitude, longitude, point.latitude, point.longitude);
+            if (distance <= radiusKm) matches.push_back(make_pair(distance, point.photoId));
+        });
+        
+        sort(matches.begin(), matches.end());
+        photoIds.reserve(matches.size());
+        for (size_t i = 0; i < matches.size(); i++) {
+            photoIds.push_back(matches[i].second);
+        }
+    }
+    
+    // IDs of the photos inside a box, ascending. A box whose west edge is
+    // east of its east edge crosses the antimeridian.
+    void searchBox(double minLat, double minLon, double maxLat, double maxLon, vector<int>& photoIds) const {
+        photoIds.clear();
+        if (minLat > maxLat) return;
+        
+        bool wraps = (minLon > maxLon);
+        int lonLow = lonCell(minLon), lonHigh = lonCell(maxLon);
+        if (wraps && lonLow == lonHigh) {
+            lonLow = 0;
+            lonHigh = LON_CELLS - 1;
+        }
+        
+        forEachCandidate(latCell(minLat), latCell(maxLat), lonLow, lonHigh, [&](const GeoPoint& point) {
+            if (point.latitude < minLat || point.latitude > maxLat) return;
+            bool inLongitude = wraps ? (point.longitude >= minLon || point.longitude <= maxLon)
+                                     : (point.longitude >= minLon && point.longitude <= maxLon);
+            if (inLongitude) photoIds.push_back(point.photoId);
+        });
+        sort(photoIds.begin(), photoIds.end());
+    }
+    
+    int getSize() const {
+        return pointCount;
+    }
+    
+    int getCellCount() const {
+        return cells.size();
+    }
+    
+    void clear() {
+        cells.clear();
+        pointCount = 0;
+    }
+};
+
 
 
 
@@ -791,6 +2253,15 @@ string timeToString(time_t time) {
 // Custom QuickSort for Photo arrays (sorting by view count, size, or date)
 enum SortType { BY_DATE, BY_SIZE, BY_VIEWS };
 
+// The value a photo is sorted on
+long long sortKey(SortType sortType, const Photo& photo) {
+    switch (sortType) {
+        case BY_DATE: return photo.getDateTime();
+        case BY_SIZE: return photo.getFileSize();
+        default: return photo.getViewCount();
+    }
+}
+
 int partitionArray(Photo** photos, int low, int high, SortType sortType) {
     Photo* pivot = photos[high];
     int i = low - 1;
@@ -829,6 +2300,142 @@ void quickSort(Photo** photos, int low, int high, SortType sortType) {
     }
 }
 
+// Photo table: a columnar copy of the fields that sorts and filters read,
+// one dense array per field indexed by store handle (the row), so a sort or
+// scan walks contiguous memory instead of following a Photo* per photo.
+// Tags are a 64-bit set per row: each of the first 63 distinct tags the
+// table sees gets its own bit, and every later tag shares the last one, so
+// rows found through that bit are checked against the Photo. A library with
+// more than 63 distinct tags therefore gets exact scans only for the tags
+// seen first; the word is not widened, to keep rows at a fixed 8 bytes of
+// tag data. Bits are never reassigned. Rows of empty slots have ID -1.
+class PhotoTable {
+private:
+    static const int OVERFLOW_TAG_BIT = 63;
+    
+    vector<int> ids;
+    vector<long long> dateTimes;
+    vector<int> fileSizes;
+    vector<int> viewCounts;
+    vector<Symbol> locations;
+    vector<uint64_t> tagBits;
+    unordered_map<Symbol, int> tagBitIndex;  // tag -> bit, for tags below OVERFLOW_TAG_BIT
+    
+    struct SortEntry {
+        long long key;
+        int id;
+        PhotoHandle row;
+    };
+    
+    uint64_t bitForTag(Symbol tag) {
+        auto it = tagBitIndex.find(tag);
+        if (it != tagBitIndex.end()) return 1ULL << it->second;
+        if ((int)tagBitIndex.size() == OVERFLOW_TAG_BIT) return 1ULL << OVERFLOW_TAG_BIT;
+        
+        int bit = tagBitIndex.size();
+        tagBitIndex[tag] = bit;
+        return 1ULL << bit;
+    }
+    
+    template <typename T>
+    void collect(const vector<T>& column, vector<SortEntry>& entries) const {
+        for (size_t row = 0; row < ids.size(); row++) {
+            if (ids[row] < 0) continue;
+            SortEntry entry = { (long long)column[row], ids[row], (PhotoHandle)row };
+            entries.push_back(entry);
+        }
+    }
+
+public:
+    // Copy a photo's fields into its row, growing the columns if needed
+    void set(PhotoHandle row, const Photo& photo) {
+        if (row >= (int)ids.size()) {
+            ids.resize(row + 1, -1);
+            dateTimes.resize(row + 1);
+            fileSizes.resize(row + 1);
+            viewCounts.resize(row + 1);
+            locations.resize(row + 1);
+            tagBits.resize(row + 1);
+        }
+        
+        ids[row] = photo.getId();
+        dateTimes[row] = photo.getDateTime();
+        fileSizes[row] = photo.getFileSize();
+        viewCounts[row] = photo.getViewCount();
+        locations[row] = photo.getLocationSymbol();
+        tagBits[row] = 0;
+        for (int i = 0; i < photo.getTagCount(); i++) {
+            tagBits[row] |= bitForTag(photo.getTagSymbol(i));
+        }
+    }
+    
+    void erase(PhotoHandle row) {
+        if (row < (int)ids.size()) ids[row] = -1;
+    }
+    
+    void setViewCount(PhotoHandle row, int viewCount) {
+        viewCounts[row] = viewCount;
+    }
+    
+    // Rows of every photo ordered by date, size or view count, ties broken
+    // by photo ID; descending is the exact reverse of ascending, matching
+    // the pages read backwards from the AVL trees
+    void sortRows(SortType sortType, bool descending, vector<PhotoHandle>& rows) const {
+        vector<SortEntry> entries;
+        entries.reserve(ids.size());
+        switch (sortType) {
+            case BY_DATE: collect(dateTimes, entries); break;
+            case BY_SIZE: collect(fileSizes, entries); break;
+            case BY_VIEWS: collect(viewCounts, entries); break;
+        }
+        
+        sort(entries.begin(), entries.end(), [descending](const SortEntry& a, const SortEntry& b) {
+            if (a.key != b.key) return descending ? a.key > b.key : a.key < b.key;
+            return descending ? a.id > b.id : a.id < b.id;
+        });
+        
+        rows.clear();
+        rows.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            rows.push_back(entries[i].row);
+        }
+    }
+    
+    // IDs of the photos at a location, ascending
+    void findLocation(Symbol location, vector<int>& photoIds) const {
+        photoIds.clear();
+        for (size_t row = 0; row < ids.size(); row++) {
+            if (locations[row] == location && ids[row] >= 0) photoIds.push_back(ids[row]);
+        }
+        sort(photoIds.begin(), photoIds.end());
+    }
+    
+    // IDs of the photos with a tag, ascending
+    void findTag(Symbol tag, const PhotoStore& store, vector<int>& photoIds) const {
+        photoIds.clear();
+        auto it = tagBitIndex.find(tag);
+        bool exact = (it != tagBitIndex.end());
+        if (!exact && (int)tagBitIndex.size() < OVERFLOW_TAG_BIT) return;  // no row has it
+        
+        uint64_t bit = 1ULL << (exact ? it->second : OVERFLOW_TAG_BIT);
+        for (size_t row = 0; row < ids.size(); row++) {
+            if ((tagBits[row] & bit) == 0 || ids[row] < 0) continue;
+            if (exact || store.get(row)->hasTag(tag)) photoIds.push_back(ids[row]);
+        }
+        sort(photoIds.begin(), photoIds.end());
+    }
+    
+    void clear() {
+        ids.clear();
+        dateTimes.clear();
+        fileSizes.clear();
+        viewCounts.clear();
+        locations.clear();
+        tagBits.clear();
+        tagBitIndex.clear();
+    }
+};
+
 
 
 
@@ -929,6 +2536,314 @@ bool KMPSearch(const string& text, const string& pattern) {
     return false;
 }
 
+// Algorithm 4: Substring scan over case-folded text. Descriptions are folded
+// to lowercase once (foldCase) when a photo is loaded or edited, so a scan
+// only folds the pattern. The SIMD kernels test 16 or 32 start positions at a
+// time against the pattern's first and last byte and only compare the middle
+// bytes at positions where both match.
+string foldCase(const string& text) {
+    string folded = text;
+    for (size_t i = 0; i < folded.length(); i++) {
+        folded[i] = tolower(folded[i]);
+    }
+    return folded;
+}
+
+bool containsFoldedScalar(const char* text, size_t n, const char* pattern, size_t m) {
+    if (m == 0) return true;
+    if (n < m) return false;
+    
+    const char* end = text + n - m + 1;  // one past the last possible start
+    for (const char* p = text; p < end; p++) {
+        p = (const char*)memchr(p, pattern[0], end - p);
+        if (p == nullptr) return false;
+        if (p[m - 1] == pattern[m - 1] && memcmp(p + 1, pattern + 1, m > 2 ? m - 2 : 0) == 0) return true;
+    }
+    return false;
+}
+
+#ifdef __SSE2__
+bool containsFoldedSSE2(const char* text, size_t n, const char* pattern, size_t m) {
+    if (m == 0) return true;
+    if (n < m) return false;
+    
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(text + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first),
+                                                        _mm_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            size_t start = i + __builtin_ctz(mask);
+            if (memcmp(text + start + 1, pattern + 1, m > 2 ? m - 2 : 0) == 0) return true;
+            mask &= mask - 1;
+        }
+    }
+    return containsFoldedScalar(text + i, n - i, pattern, m);
+}
+#endif
+
+#ifdef PHOTO_GALLERY_AVX2
+__attribute__((target("avx2")))
+bool containsFoldedAVX2(const char* text, size_t n, const char* pattern, size_t m) {
+    if (m == 0) return true;
+    if (n < m) return false;
+    
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(text + i + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first),
+                                                              _mm256_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            size_t start = i + __builtin_ctz(mask);
+            if (memcmp(text + start + 1, pattern + 1, m > 2 ? m - 2 : 0) == 0) return true;
+            mask &= mask - 1;
+        }
+    }
+    return containsFoldedScalar(text + i, n - i, pattern, m);
+}
+#endif
+
+typedef bool (*ContainsKernel)(const char* text, size_t n, const char* pattern, size_t m);
+
+// Widest kernel this CPU supports, chosen once at startup
+ContainsKernel selectContainsKernel() {
+#ifdef PHOTO_GALLERY_AVX2
+    if (__builtin_cpu_supports("avx2")) return containsFoldedAVX2;
+#endif
+#ifdef __SSE2__
+    return containsFoldedSSE2;
+#else
+    return containsFoldedScalar;
+#endif
+}
+
+const ContainsKernel containsFoldedKernel = selectContainsKernel();
+
+// Whether folded text contains folded pattern
+bool containsFolded(const string& text, const string& pattern) {
+    return containsFoldedKernel(text.data(), text.length(), pattern.data(), pattern.length());
+}
+
+// Algorithm 5: Suffix array over all descriptions for substring search.
+// Lowercased descriptions are concatenated, each ended by '\0', and every
+// text position is sorted by the suffix starting there, so the suffixes
+// beginning with a pattern form one contiguous run found by binary search.
+// lcp[i] (common prefix of suffixes i-1 and i) then extends the run without
+// further string compares, so a query costs O(m log n + hits).
+//
+// The index is built lazily and split into
+// shards of at most shardBytes of text, each sorted on its own, which bounds
+// the memory of a build. Photos added, edited or deleted after a build are
+// recorded in changedIds: their index hits are dropped and their current
+// descriptions scanned with containsFolded, until enough have changed to
+// rebuild.
+class SubstringIndex {
+private:
+    struct Shard {
+        string text;                   // lowercase descriptions, each followed by '\0'
+        vector<int> docStarts;         // offset of each description in text
+        vector<int> docIds;            // photo ID of each description
+        vector<int> suffixes;          // text offsets in sorted suffix order
+        vector<unsigned short> lcp;    // capped at LCP_CAP
+    };
+    
+    static const unsigned short LCP_CAP = 65535;
+    static const size_t MIN_CHANGES_BEFORE_REBUILD = 1024;
+    
+    vector<Shard> shards;
+    size_t shardBytes;
+    bool built;
+    int documentCount;
+    vector<int> changedIds;  // sorted photo IDs changed since the build
+    
+    // Multikey quicksort of suffixes[low, high), which already agree on their
+    // first depth bytes: three-way partition on the byte at depth, so the long
+    // prefixes that repeated words share are compared once, not per pair
+    static void sortSuffixes(const unsigned char* text, int* suffixes, int low, int high, int depth) {
+        while (high - low > 16) {
+            unsigned char pivot = text[suffixes[low + (high - low) / 2] + depth];
+            int less = low, equal = low, greater = high;
+            while (equal < greater) {
+                unsigned char c = text[suffixes[equal] + depth];
+                if (c < pivot) {
+                    swap(suffixes[less++], suffixes[equal++]);
+                } else if (c > pivot) {
+                    swap(suffixes[equal], suffixes[--greater]);
+                } else {
+                    equal++;
+                }
+            }
+            sortSuffixes(text, suffixes, low, less, depth);
+            sortSuffixes(text, suffixes, greater, high, depth);
+            if (pivot == 0) return;  // equal run ends here: identical suffixes
+            low = less;
+            high = greater;
+            depth++;
+        }
+        
+        // Insertion sort for short runs
+        for (int i = low + 1; i < high; i++) {
+            int suffix = suffixes[i];
+            int j = i;
+            while (j > low && strcmp((const char*)text + suffixes[j - 1] + depth, (const char*)text + suffix + depth) > 0) {
+                suffixes[j] = suffixes[j - 1];
+                j--;
+            }
+            suffixes[j] = suffix;
+        }
+    }
+    
+    static void sortShard(Shard& shard) {
+        const unsigned char* text = (const unsigned char*)shard.text.c_str();
+        size_t length = shard.text.length();
+        
+        shard.suffixes.clear();
+        shard.suffixes.reserve(length);
+        for (size_t i = 0; i < length; i++) {
+            if (text[i] != 0) shard.suffixes.push_back(i);
+        }
+        sortSuffixes(text, shard.suffixes.data(), 0, shard.suffixes.size(), 0);
+        
+        shard.lcp.assign(shard.suffixes.size(), 0);
+        for (size_t i = 1; i < shard.suffixes.size(); i++) {
+            const unsigned char* x = text + shard.suffixes[i - 1];
+            const unsigned char* y = text + shard.suffixes[i];
+            size_t common = 0;
+            while (x[common] != 0 && x[common] == y[common] && common < LCP_CAP) common++;
+            shard.lcp[i] = common;
+        }
+    }
+    
+    // Append the sorted, unique IDs of shard documents containing pattern
+    static void searchShard(const Shard& shard, const string& pattern, vector<int>& photoIds) {
+        size_t m = pattern.length();
+        if (m == 0) {
+            photoIds.insert(photoIds.end(), shard.docIds.begin(), shard.docIds.end());
+            return;
+        }
+        
+        const char* text = shard.text.c_str();
+        size_t low = 0, high = shard.suffixes.size();
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (strncmp(text + shard.suffixes[mid], pattern.c_str(), m) < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        
+        vector<int> docs;
+        for (size_t i = low; i < shard.suffixes.size(); i++) {
+            bool matches = (i > low && m <= LCP_CAP) ? shard.lcp[i] >= m
+                                                     : strncmp(text + shard.suffixes[i], pattern.c_str(), m) == 0;
+            if (!matches) break;
+            docs.push_back(upper_bound(shard.docStarts.begin(), shard.docStarts.end(), shard.suffixes[i]) -
+                           shard.docStarts.begin() - 1);
+        }
+        
+        sort(docs.begin(), docs.end());
+        docs.erase(unique(docs.begin(), docs.end()), docs.end());
+        for (size_t i = 0; i < docs.size(); i++) {
+            photoIds.push_back(shard.docIds[docs[i]]);
+        }
+    }
+
+public:
+    explicit SubstringIndex(size_t shardBytes = 32 << 20)
+        : shardBytes(shardBytes), built(false), documentCount(0) {}
+    
+    // Whether the next search should rebuild first: never built, or so many
+    // photos changed that rescanning them costs more than it saves
+    bool needsRebuild() const {
+        return !built || changedIds.size() > max((size_t)MIN_CHANGES_BEFORE_REBUILD, (size_t)documentCount / 16);
+    }
+    
+    // Rebuild from scratch: beginBuild(), addDocument() for each photo in
+    // increasing ID order, then endBuild()
+    void beginBuild() {
+        shards.clear();
+        changedIds.clear();
+        documentCount = 0;
+        built = false;
+    }
+    
+    // Add one already case-folded description
+    void addDocument(int photoId, const string& description) {
+        if (shards.empty() || (!shards.back().docIds.empty() &&
+                               shards.back().text.length() + description.length() + 1 > shardBytes)) {
+            if (!shards.empty()) sortShard(shards.back());
+            shards.push_back(Shard());
+        }
+        
+        Shard& shard = shards.back();
+        shard.docStarts.push_back(shard.text.length());
+        shard.docIds.push_back(photoId);
+        size_t start = shard.text.length();
+        shard.text += description;
+        replace(shard.text.begin() + start, shard.text.end(), '\0', ' ');
+        shard.text += '\0';
+        documentCount++;
+    }
+    
+    void endBuild() {
+        if (!shards.empty()) sortShard(shards.back());
+        built = true;
+    }
+    
+    // Record that a photo was added, edited or deleted since the build
+    void markChanged(int photoId) {
+        if (built) insertSortedId(changedIds, photoId);
+    }
+    
+    bool isBuilt() const {
+        return built;
+    }
+    
+    // Sorted IDs of photos whose description contains pattern (already
+    // case-folded). foldedById returns the current folded description of a
+    // changed photo, nullptr for deleted ones.
+    template <typename Lookup>
+    void search(const string& pattern, Lookup foldedById, vector<int>& photoIds) const {
+        photoIds.clear();
+        for (size_t i = 0; i < shards.size(); i++) {
+            searchShard(shards[i], pattern, photoIds);
+        }
+        if (changedIds.empty()) return;
+        
+        vector<int> unchanged, rescanned;
+        subtractSortedIds(photoIds, changedIds, unchanged);
+        for (size_t i = 0; i < changedIds.size(); i++) {
+            const string* description = foldedById(changedIds[i]);
+            if (description != nullptr && containsFolded(*description, pattern)) {
+                rescanned.push_back(changedIds[i]);
+            }
+        }
+        unionSortedIds(unchanged, rescanned, photoIds);
+    }
+    
+    int getShardCount() const {
+        return shards.size();
+    }
+    
+    // Heap footprint of text, suffix and LCP arrays
+    size_t getMemoryUsage() const {
+        size_t bytes = 0;
+        for (size_t i = 0; i < shards.size(); i++) {
+            const Shard& shard = shards[i];
+            bytes += shard.text.capacity() + (shard.docStarts.capacity() + shard.docIds.capacity() +
+                     shard.suffixes.capacity()) * sizeof(int) + shard.lcp.capacity() * sizeof(unsigned short);
+        }
+        return bytes;
+    }
+};
+
 // Database callback function
 static int callback(void* data, int argc, char** argv, char** azColName) {
     int* id = static_cast<int*>(data);
@@ -936,72 +2851,604 @@ static int callback(void* data, int argc, char** argv, char** azColName) {
     return 0;
 }
 
+// SQLite settings applied when the database is opened. "safe" keeps
+// SQLite's own defaults (rollback journal, synchronous=FULL); "balanced"
+// switches to WAL, which stays consistent after a crash but may lose the
+// last commits on power loss; "bulk-load" stops syncing entirely and is
+// meant for one-off imports. "safe" is the default so that nothing
+// trades durability for speed unless asked to.
+struct DatabaseProfile {
+    const char* name;
+    const char* journalMode;
+    const char* synchronous;
+    long long mmapSize;    // bytes mapped for reads, 0 = off
+    int cacheSize;         // negative = KiB, as in PRAGMA cache_size
+    const char* tempStore;
+};
+
+const DatabaseProfile DATABASE_PROFILES[] = {
+    { "safe",      "DELETE", "FULL",   0,                    -2000,   "DEFAULT" },
+    { "balanced",  "WAL",    "NORMAL", 256LL * 1024 * 1024,  -65536,  "MEMORY"  },
+    { "bulk-load", "WAL",    "OFF",    1024LL * 1024 * 1024, -262144, "MEMORY"  },
+};
+const int DATABASE_PROFILE_COUNT = sizeof(DATABASE_PROFILES) / sizeof(DATABASE_PROFILES[0]);
+const char* const DEFAULT_DATABASE_PROFILE = "safe";
+
+// How long a statement waits for another connection's lock before it fails
+// with SQLITE_BUSY
+const int BUSY_TIMEOUT_MS = 5000;
+
+// Look up a profile by name; returns nullptr if there is none
+const DatabaseProfile* findDatabaseProfile(const string& name) {
+    for (int i = 0; i < DATABASE_PROFILE_COUNT; i++) {
+        if (name == DATABASE_PROFILES[i].name) {
+            return &DATABASE_PROFILES[i];
+        }
+    }
+    return nullptr;
+}
+
+// Schema migrations, applied in order by PhotoGallerySystem::migrateSchema().
+// Version 1 is the original schema, so databases created before versioning
+// (user_version 0) upgrade through the same steps as new ones. Append new
+// versions here; never edit one that has shipped.
+struct SchemaMigration {
+    int version;
+    const char* sql;
+};
+
+const SchemaMigration SCHEMA_MIGRATIONS[] = {
+    { 1,
+      "CREATE TABLE IF NOT EXISTS photos("
+      "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "filename TEXT NOT NULL,"
+      "location TEXT,"
+      "date_time INTEGER,"
+      "description TEXT,"
+      "file_size INTEGER,"
+      "view_count INTEGER DEFAULT 0);"
+      "CREATE TABLE IF NOT EXISTS tags("
+      "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "photo_id INTEGER,"
+      "tag TEXT NOT NULL,"
+      "FOREIGN KEY(photo_id) REFERENCES photos(id));" },
+    // Indexes for the tag join and delete, and for SQL-side filters and sorts
+    { 2,
+      "CREATE INDEX IF NOT EXISTS idx_tags_photo_id ON tags(photo_id);"
+      "CREATE INDEX IF NOT EXISTS idx_tags_tag ON tags(tag);"
+      "CREATE INDEX IF NOT EXISTS idx_photos_date_time ON photos(date_time);"
+      "CREATE INDEX IF NOT EXISTS idx_photos_location ON photos(location);"
+      "CREATE INDEX IF NOT EXISTS idx_photos_view_count ON photos(view_count);" },
+    // Tag dictionary: each distinct tag gets an integer id, and tags rows
+    // reference it through tag_id (tag keeps the text for older readers)
+    { 3,
+      "CREATE TABLE IF NOT EXISTS tag_names("
+      "id INTEGER PRIMARY KEY,"
+      "name TEXT NOT NULL UNIQUE);"
+      "INSERT OR IGNORE INTO tag_names (name) SELECT DISTINCT tag FROM tags;"
+      "ALTER TABLE tags ADD COLUMN tag_id INTEGER REFERENCES tag_names(id);"
+      "UPDATE tags SET tag_id = (SELECT id FROM tag_names WHERE name = tags.tag);"
+      "CREATE INDEX IF NOT EXISTS idx_tags_tag_id ON tags(tag_id);" },
+    // Change counter bumped by every row written to photos, so a snapshot of
+    // the tables can tell whether it is still current, and a random ID that
+    // tells a recreated database from the one it replaced. Tags rows are
+    // only written in the same transaction as their photo's row, which
+    // keeps per-row triggers off the three-times-larger tags table.
+    { 4,
+      "CREATE TABLE IF NOT EXISTS gallery_state("
+      "id INTEGER PRIMARY KEY CHECK (id = 1),"
+      "change_count INTEGER NOT NULL,"
+      "database_id BLOB NOT NULL);"
+      "INSERT OR IGNORE INTO gallery_state (id, change_count, database_id) VALUES (1, 0, randomblob(16));"
+      "CREATE TRIGGER IF NOT EXISTS photos_insert_changed AFTER INSERT ON photos "
+      "BEGIN UPDATE gallery_state SET change_count = change_count + 1; END;"
+      "CREATE TRIGGER IF NOT EXISTS photos_update_changed AFTER UPDATE ON photos "
+      "BEGIN UPDATE gallery_state SET change_count = change_count + 1; END;"
+      "CREATE TRIGGER IF NOT EXISTS photos_delete_changed AFTER DELETE ON photos "
+      "BEGIN UPDATE gallery_state SET change_count = change_count + 1; END;" },
+    // Numeric coordinates for locations that are "lat, lon" pairs (NULL
+    // otherwise), kept in step with location by every write
+    { 5,
+      "ALTER TABLE photos ADD COLUMN latitude REAL;"
+      "ALTER TABLE photos ADD COLUMN longitude REAL;"
+      "UPDATE photos SET latitude = gallery_latitude(location), longitude = gallery_longitude(location);" },
+    // Views get a counter of their own, so that viewing a photo no longer
+    // makes the snapshot stale: only the view counts need reading again
+    { 6,
+      "ALTER TABLE gallery_state ADD COLUMN view_change_count INTEGER NOT NULL DEFAULT 0;"
+      "DROP TRIGGER IF EXISTS photos_update_changed;"
+      "CREATE TRIGGER photos_update_changed AFTER UPDATE OF "
+      "filename, location, date_time, description, file_size, latitude, longitude ON photos "
+      "BEGIN UPDATE gallery_state SET change_count = change_count + 1; END;"
+      "CREATE TRIGGER photos_view_changed AFTER UPDATE OF view_count ON photos "
+      "BEGIN UPDATE gallery_state SET view_change_count = view_change_count + 1; END;" },
+};
+const int SCHEMA_MIGRATION_COUNT = sizeof(SCHEMA_MIGRATIONS) / sizeof(SCHEMA_MIGRATIONS[0]);
+
+// SQL functions gallery_latitude(location) and gallery_longitude(location):
+// the coordinate parseCoordinates() reads from a location, or NULL
+static void coordinateFunction(sqlite3_context* context, int /*argc*/, sqlite3_value** argv) {
+    const unsigned char* location = sqlite3_value_text(argv[0]);
+    double latitude, longitude;
+    if (location == nullptr || !parseCoordinates((const char*)location, latitude, longitude)) {
+        sqlite3_result_null(context);
+        return;
+    }
+    bool wantLatitude = (sqlite3_user_data(context) != nullptr);
+    sqlite3_result_double(context, wantLatitude ? latitude : longitude);
+}
+
+bool registerCoordinateFunctions(sqlite3* db) {
+    static int latitudeTag;
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    return sqlite3_create_function(db, "gallery_latitude", 1, flags, &latitudeTag,
+                                   coordinateFunction, nullptr, nullptr) == SQLITE_OK &&
+           sqlite3_create_function(db, "gallery_longitude", 1, flags, nullptr,
+                                   coordinateFunction, nullptr, nullptr) == SQLITE_OK;
+}
+
+// Prepared statements keyed by their SQL text. Each statement is prepared
+// the first time it is asked for and then reused for the life of the
+// connection; get() hands it back reset with its bindings cleared. clear()
+// must run before the connection is closed.
+class StatementCache {
+private:
+    sqlite3* db;
+    unordered_map<string, sqlite3_stmt*> statements;
+    
+    StatementCache(const StatementCache&);
+    StatementCache& operator=(const StatementCache&);
+
+public:
+    StatementCache() : db(nullptr) {}
+    
+    ~StatementCache() {
+        clear();
+    }
+    
+    void setDatabase(sqlite3* database) {
+        clear();
+        db = database;
+    }
+    
+    // Statement for sql ready to bind and step, nullptr if it fails to prepare
+    sqlite3_stmt* get(const char* sql) {
+        unordered_map<string, sqlite3_stmt*>::iterator it = statements.find(sql);
+        if (it != statements.end()) {
+            sqlite3_reset(it->second);
+            sqlite3_clear_bindings(it->second);
+            return it->second;
+        }
+        
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+            return nullptr;
+        }
+        statements[sql] = stmt;
+        return stmt;
+    }
+    
+    // Finalize every statement
+    void clear() {
+        for (unordered_map<string, sqlite3_stmt*>::iterator it = statements.begin(); it != statements.end(); ++it) {
+            sqlite3_finalize(it->second);
+        }
+        statements.clear();
+    }
+    
+    int getSize() const {
+        return statements.size();
+    }
+};
+
+// Savepoint held for one scope: rolled back unless release() is called.
+// Savepoints nest, so one can be taken inside an explicit transaction.
+class Savepoint {
+private:
+    StatementCache& statements;
+    bool open;
+    
+    Savepoint(const Savepoint&);
+    Savepoint& operator=(const Savepoint&);
+    
+    bool run(const char* sql) {
+        sqlite3_stmt* stmt = statements.get(sql);
+        if (stmt == nullptr) return false;
+        int rc = sqlite3_step(stmt);
+        if (rc != SQLITE_DONE) {
+            cerr << "Execution failed: " << sqlite3_errmsg(sqlite3_db_handle(stmt)) << endl;
+        }
+        sqlite3_reset(stmt);
+        return rc == SQLITE_DONE;
+    }
+
+public:
+    explicit Savepoint(StatementCache& statements) : statements(statements), open(true) {
+        run("SAVEPOINT photo_write;");
+    }
+    
+    ~Savepoint() {
+        if (open) {
+            run("ROLLBACK TO photo_write;");
+            run("RELEASE photo_write;");
+        }
+    }
+    
+    // Release the savepoint, which commits unless it is nested in a
+    // transaction. If that fails (the database stays locked past the busy
+    // timeout, say), the writes since the savepoint are rolled back and
+    // false is returned.
+    bool release() {
+        open = false;
+        if (run("RELEASE photo_write;")) {
+            return true;
+        }
+        run("ROLLBACK TO photo_write;");
+        run("RELEASE photo_write;");
+        return false;
+    }
+};
+
+// The gallery's secondary indexes. Each one is built from the photo store
+// the first time a query needs it and kept current from then on; until
+// then, writes skip it.
+enum GalleryIndex {
+    INDEX_FOLDED_DESCRIPTIONS,
+    INDEX_TAG_TRIE,
+    INDEX_TAG_POSTINGS,
+    INDEX_TEXT,
+    INDEX_ID_TREE,
+    INDEX_DATE_TREE,
+    INDEX_SIZE_TREE,
+    INDEX_POPULARITY_TREE,
+    INDEX_RECENT_QUEUE,
+    INDEX_POPULAR_QUEUE,
+    INDEX_LOCATION_MAP,
+    INDEX_PHOTO_LIST,
+    INDEX_PHOTO_TABLE,
+    INDEX_GEO,
+    GALLERY_INDEX_COUNT
+};
+
+// Which gallery indexes have been built
+class IndexRegistry {
+private:
+    bool built[GALLERY_INDEX_COUNT];
+
+public:
+    IndexRegistry() {
+        fill(built, built + GALLERY_INDEX_COUNT, false);
+    }
+    
+    bool isBuilt(GalleryIndex index) const {
+        return built[index];
+    }
+    
+    void markBuilt(GalleryIndex index) {
+        built[index] = true;
+    }
+    
+    int getBuiltCount() const {
+        return (int)count(built, built + GALLERY_INDEX_COUNT, true);
+    }
+    
+    static const char* getName(GalleryIndex index) {
+        static const char* const NAMES[GALLERY_INDEX_COUNT] = {
+            "folded descriptions", "tag trie", "tag postings", "text index", "ID tree", "date tree",
+            "size tree", "popularity tree", "recent queue", "popular queue", "location map",
+            "photo list", "photo table", "geo index"
+        };
+        return NAMES[index];
+    }
+};
+
+// Binary snapshot of the loaded gallery, written next to the database as
+// <db>.snapshot so that a start with an unchanged database can skip SQLite.
+// The file is a header followed by flat, 8-byte aligned arrays; strings are
+// (offset, length) pairs into one pool, and every other reference is an
+// array index, so nothing needs fixing up. Loading still copies every photo
+// into the store, so this saves the SQL queries and the index builds, not
+// the deserialization. Photos are stored in ID order, so record i becomes
+// store handle i on load, and the date/popularity orders and the postings
+// are read in place when the indexes are first needed. The header's change
+// count and database ID must match gallery_state or the snapshot is
+// ignored; a different view change count only means the view counts are
+// read again from the database. Files are only
+// valid on machines with the byte order and struct layout they were
+// written with, which the header also records.
+const size_t SNAPSHOT_DATABASE_ID_BYTES = 16;
+
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotPhoto {
+    int64_t dateTime;
+    int32_t id;
+    int32_t fileSize;
+    int32_t viewCount;
+    uint32_t tagCount;
+    uint32_t firstTag;  // index of the first of tagCount entries in the tag section
+    SnapshotString filename;
+    SnapshotString location;
+    SnapshotString description;
+};
+
+// One key (a tag or a location) and its photos: count photo IDs starting
+// at first in the posting section, in increasing order
+struct SnapshotPosting {
+    SnapshotString key;
+    uint32_t first;
+    uint32_t count;
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;        // SNAPSHOT_BYTE_ORDER as the writer stored it
+    uint32_t photoRecordSize;  // sizeof(SnapshotPhoto) for the writer
+    uint32_t photoCount;
+    int64_t changeCount;
+    int64_t viewChangeCount;
+    unsigned char databaseId[SNAPSHOT_DATABASE_ID_BYTES];  // gallery_state.database_id
+    uint64_t fileSize;          // a multiple of 8
+    uint64_t checksum;          // snapshotChecksum() of everything after the header
+    uint64_t stringBytes;
+    uint32_t tagCount;          // entries in the tag section
+    uint32_t tagPostingCount;
+    uint32_t locationPostingCount;
+    uint32_t postingIdCount;
+    uint64_t photosOffset;      // SnapshotPhoto[photoCount]
+    uint64_t tagsOffset;        // SnapshotString[tagCount]
+    uint64_t dateOrderOffset;   // int32_t[photoCount], record indexes by (date, index)
+    uint64_t popularityOrderOffset;  // int32_t[photoCount], by (view count, index)
+    uint64_t tagPostingsOffset;      // SnapshotPosting[tagPostingCount]
+    uint64_t locationPostingsOffset; // SnapshotPosting[locationPostingCount]
+    uint64_t postingIdsOffset;       // int32_t[postingIdCount], photo IDs
+    uint64_t stringsOffset;          // char[stringBytes]
+};
+
+static_assert(sizeof(SnapshotHeader) % 8 == 0, "sections after the header must stay 8-byte aligned");
+
+const char SNAPSHOT_MAGIC[8] = { 'P', 'G', 'S', 'N', 'A', 'P', '\r', '\n' };
+const uint32_t SNAPSHOT_VERSION = 2;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// Checksum of a snapshot body, a word at a time; size is a multiple of 8
+uint64_t snapshotChecksum(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Read-only view of a snapshot file: mmap where available, otherwise the
+// whole file read into memory. open() checks the header, the checksum and
+// that every section lies inside the file; the references inside records
+// are checked by the loader as it reads them.
+class SnapshotImage {
+private:
+    const char* data;
+    size_t size;
+    bool mapped;
+    vector<char> buffer;
+    
+    SnapshotImage(const SnapshotImage&);
+    SnapshotImage& operator=(const SnapshotImage&);
+    
+    bool sectionFits(uint64_t offset, uint64_t count, size_t itemSize) const {
+        return offset % 8 == 0 && offset <= size && count <= (size - offset) / itemSize;
+    }
+    
+    bool validate() const {
+        if (size < sizeof(SnapshotHeader)) return false;
+        const SnapshotHeader& h = header();
+        return memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+               h.version == SNAPSHOT_VERSION &&
+               h.byteOrder == SNAPSHOT_BYTE_ORDER &&
+               h.photoRecordSize == sizeof(SnapshotPhoto) &&
+               h.fileSize == size && size % 8 == 0 &&
+               sectionFits(h.photosOffset, h.photoCount, sizeof(SnapshotPhoto)) &&
+               sectionFits(h.tagsOffset, h.tagCount, sizeof(SnapshotString)) &&
+               sectionFits(h.dateOrderOffset, h.photoCount, sizeof(int32_t)) &&
+               sectionFits(h.popularityOrderOffset, h.photoCount, sizeof(int32_t)) &&
+               sectionFits(h.tagPostingsOffset, h.tagPostingCount, sizeof(SnapshotPosting)) &&
+               sectionFits(h.locationPostingsOffset, h.locationPostingCount, sizeof(SnapshotPosting)) &&
+               sectionFits(h.postingIdsOffset, h.postingIdCount, sizeof(int32_t)) &&
+               sectionFits(h.stringsOffset, h.stringBytes, 1);
+    }
+
+public:
+    SnapshotImage() : data(nullptr), size(0), mapped(false) {}
+    
+    ~SnapshotImage() {
+        close();
+    }
+    
+    // Map the file; false (and nothing open) if it is missing, malformed or
+    // fails its checksum
+    bool open(const string& path) {
+        close();
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                data = static_cast<const char*>(address);
+                size = info.st_size;
+                mapped = true;
+            }
+        }
+        ::close(fd);
+#else
+        ifstream file(path.c_str(), ios::binary);
+        if (file) {
+            buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            data = buffer.data();
+            size = buffer.size();
+        }
+#endif
+        if (data == nullptr || !validate() ||
+            snapshotChecksum(data + sizeof(SnapshotHeader), size - sizeof(SnapshotHeader)) != header().checksum) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+#ifndef _WIN32
+        if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+        vector<char>().swap(buffer);
+        data = nullptr;
+        size = 0;
+        mapped = false;
+    }
+    
+    bool isOpen() const {
+        return data != nullptr;
+    }
+    
+    const SnapshotHeader& header() const {
+        return *reinterpret_cast<const SnapshotHeader*>(data);
+    }
+    
+    // Section starting at offset; its bounds were checked by open()
+    template <typename T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data + offset);
+    }
+    
+    bool stringFits(const SnapshotString& value) const {
+        return value.offset <= header().stringBytes && value.length <= header().stringBytes - value.offset;
+    }
+    
+    string getString(const SnapshotString& value) const {
+        return string(data + header().stringsOffset + value.offset, value.length);
+    }
+};
+
 // Photo Gallery System class
 class PhotoGallerySystem {
 private:
     sqlite3* db;
-    Photo* photos[1000];
-    int photoCount;
+    const DatabaseProfile* profile;  // PRAGMAs applied on open
+    StatementCache statements;  // every prepared statement on db
+    PhotoStore store;
+    vector<PhotoHandle> idIndex;  // primary key index: photo id -> store handle (NO_PHOTO if none)
+    vector<string> foldedDescriptions;  // photo id -> lowercase description for substring scans
     
+    AVLTree idTree;  // pages of get_all_photos
     AVLTree dateTree;
+    AVLTree sizeTree;
     AVLTree popularityTree;
     Trie tagTrie;
+    TagIndex tagIndex;
+    TextIndex textIndex;
+    SubstringIndex substringIndex;  // built from the second description search on
+    int descriptionSearchCount;
+    IndexRegistry indexes;  // which of the structures below are built
     PriorityQueue recentQueue;
     PriorityQueue popularQueue;
     HashMap locationMap;
     LinkedList photoList;
+    PhotoTable photoTable;  // columns for sorts and one-off tag/location scans
+    GeoIndex geoIndex;
+    int tagSearchCount;
+    int locationSearchCount;
+    string snapshotPath;    // empty for in-memory databases
+    SnapshotImage snapshot;  // open only while memory still matches it
+    
+    // Apply the PRAGMAs of a profile
+    bool applyProfile(const DatabaseProfile& settings) {
+        ostringstream pragmas;
+        pragmas << "PRAGMA journal_mode = " << settings.journalMode << ";"
+                << "PRAGMA synchronous = " << settings.synchronous << ";"
+                << "PRAGMA mmap_size = " << settings.mmapSize << ";"
+                << "PRAGMA cache_size = " << settings.cacheSize << ";"
+                << "PRAGMA temp_store = " << settings.tempStore << ";";
+        
+        char* errMsg;
+        int rc = sqlite3_exec(db, pragmas.str().c_str(), nullptr, nullptr, &errMsg);
+        if (rc != SQLITE_OK) {
+            cerr << "SQL error: " << errMsg << endl;
+            sqlite3_free(errMsg);
+            return false;
+        }
+        return true;
+    }
     
     // Initialize database
-    bool initDatabase() {
-        int rc = sqlite3_open("photo_gallery.db", &db);
+    bool initDatabase(const string& dbPath) {
+        int rc = sqlite3_open(dbPath.c_str(), &db);
         if (rc) {
             cerr << "Can't open database: " << sqlite3_errmsg(db) << endl;
             return false;
         }
+        statements.setDatabase(db);
         
-        // Create tables if they don't exist
-        const char* createPhotoTable = 
-            "CREATE TABLE IF NOT EXISTS photos("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "filename TEXT NOT NULL,"
-            "location TEXT,"
-            "date_time INTEGER,"
-            "description TEXT,"
-            "file_size INTEGER,"
-            "view_count INTEGER DEFAULT 0);";
-            
-        const char* createTagTable = 
-            "CREATE TABLE IF NOT EXISTS tags("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "photo_id INTEGER,"
-            "tag TEXT NOT NULL,"
-            "FOREIGN KEY(photo_id) REFERENCES photos(id));";
-            
-        char* errMsg;
-        rc = sqlite3_exec(db, createPhotoTable, nullptr, nullptr, &errMsg);
-        if (rc != SQLITE_OK) {
-            cerr << "SQL error: " << errMsg << endl;
-            sqlite3_free(errMsg);
+        // Wait for other connections' locks rather than failing at once
+        sqlite3_busy_timeout(db, BUSY_TIMEOUT_MS);
+        
+        if (!applyProfile(*profile)) {
             return false;
         }
         
-        rc = sqlite3_exec(db, createTagTable, nullptr, nullptr, &errMsg);
-        if (rc != SQLITE_OK) {
-            cerr << "SQL error: " << errMsg << endl;
-            sqlite3_free(errMsg);
+        if (!registerCoordinateFunctions(db)) {
+            cerr << "Failed to register SQL functions: " << sqlite3_errmsg(db) << endl;
+            return false;
+        }
+        
+        return migrateSchema();
+    }
+    
+    // Bring the schema up to the newest version. PRAGMA user_version records
+    // the last migration applied; each pending one runs in its own
+    // transaction, so an interrupted upgrade resumes where it stopped.
+    bool migrateSchema() {
+        int version = 0;
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) != SQLITE_OK) {
+            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
             return false;
         }
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
         
+        for (int i = 0; i < SCHEMA_MIGRATION_COUNT; i++) {
+            const SchemaMigration& migration = SCHEMA_MIGRATIONS[i];
+            if (migration.version <= version) continue;
+            
+            ostringstream sql;
+            sql << "BEGIN;" << migration.sql << "PRAGMA user_version = " << migration.version << ";COMMIT;";
+            
+            char* errMsg;
+            int rc = sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &errMsg);
+            if (rc != SQLITE_OK) {
+                cerr << "Schema migration " << migration.version << " failed: " << errMsg << endl;
+                sqlite3_free(errMsg);
+                sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+                return false;
+            }
+        }
         return true;
     }
     
     // Load all photos from database
     void loadPhotosFromDB() {
-        photoCount = 0;
-        
-        // Clear existing data structures
-        recentQueue.clear();
-        popularQueue.clear();
+        idIndex.clear();
+        store.clear();
         
         // SQL to retrieve all photos
         const char* sql = "SELECT p.id, p.filename, p.location, p.date_time, p.description, "
@@ -1036,34 +3483,16 @@ private:
             int fileSize = sqlite3_column_int(stmt, 5);
             int viewCount = sqlite3_column_int(stmt, 6);
             
-            Photo* photo = new Photo(id, filename, location, dateTime, description, fileSize, viewCount);
+            PhotoHandle handle = store.add(Photo(id, filename, location, dateTime, description, fileSize, viewCount));
             
             // Add tags if available
             if (sqlite3_column_text(stmt, 7) != nullptr) {
-                string tagsStr = (char*)sqlite3_column_text(stmt, 7);
-                photo->setTags(tagsStr);
-                
-                // Add tags to trie
-                stringstream ss(tagsStr);
-                string tag;
-                while (getline(ss, tag, ',')) {
-                    // Trim whitespace
-                    tag.erase(0, tag.find_first_not_of(" \t\n\r\f\v"));
-                    tag.erase(tag.find_last_not_of(" \t\n\r\f\v") + 1);
-                    if (!tag.empty()) {
-                        tagTrie.insert(tag, id);
-                    }
-                }
+                store.get(handle)->setTags((char*)sqlite3_column_text(stmt, 7));
             }
             
-            // Add to arrays and data structures
-            photos[photoCount++] = photo;
-            photoList.append(photo);
-            dateTree.insert(*photo);
-            popularityTree.insert(*photo, false);
-            recentQueue.insert(photo);
-            popularQueue.insert(photo);
-            locationMap.insert(location, id);
+            // Only the primary key index is built here; the rest wait
+            // for the first query that needs them
+            indexPhotoId(id, handle);
         }
         
         sqlite3_finalize(stmt);
@@ -1075,204 +3504,655 @@ private:
 
 
 
+    // Read the change counters and database ID kept by the migration 4 and 6
+    // triggers
+    bool readDatabaseState(long long& changeCount, long long& viewChangeCount, string& databaseId) {
+        sqlite3_stmt* stmt = statements.get("SELECT change_count, view_change_count, database_id "
+                                            "FROM gallery_state WHERE id = 1;");
+        if (stmt == nullptr || sqlite3_step(stmt) != SQLITE_ROW) {
+            if (stmt != nullptr) sqlite3_reset(stmt);
+            return false;
+        }
+        changeCount = sqlite3_column_int64(stmt, 0);
+        viewChangeCount = sqlite3_column_int64(stmt, 1);
+        databaseId.assign((const char*)sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2));
+        sqlite3_reset(stmt);
+        return databaseId.length() == SNAPSHOT_DATABASE_ID_BYTES;
+    }
+    
+    // Replace the view counts of the loaded photos with the database's
+    void refreshViewCounts() {
+        sqlite3_stmt* stmt = statements.get("SELECT id, view_count FROM photos;");
+        if (stmt == nullptr) {
+            return;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            Photo* photo = store.get(handleForId(sqlite3_column_int(stmt, 0)));
+            if (photo != nullptr) photo->setViewCount(sqlite3_column_int(stmt, 1));
+        }
+        sqlite3_reset(stmt);
+    }
+    
+    // Fill the store from the snapshot file if it matches the database,
+    // taking the view counts from the database if photos were viewed since
+    // it was written. The file stays open so that lazily built indexes can
+    // use its sections. Returns false, with the store still empty, if there
+    // is no usable snapshot.
+    bool loadSnapshot() {
+        long long changeCount, viewChangeCount;
+        string databaseId;
+        if (snapshotPath.empty() || !snapshot.open(snapshotPath)) {
+            return false;
+        }
+        
+        // Read the state and the view counts in one transaction (nothing is
+        // written, so the savepoint's rollback is harmless)
+        Savepoint read(statements);
+        const SnapshotHeader& header = snapshot.header();
+        if (!readDatabaseState(changeCount, viewChangeCount, databaseId) || header.changeCount != changeCount ||
+            memcmp(header.databaseId, databaseId.data(), SNAPSHOT_DATABASE_ID_BYTES) != 0) {
+            snapshot.close();
+            return false;
+        }
+        
+        const SnapshotPhoto* records = snapshot.section<SnapshotPhoto>(header.photosOffset);
+        const SnapshotString* tags = snapshot.section<SnapshotString>(header.tagsOffset);
+        store.reserve(header.photoCount);
+        int previousId = 0;
+        for (uint32_t i = 0; i < header.photoCount; i++) {
+            const SnapshotPhoto& record = records[i];
+            bool valid = record.id > previousId && snapshot.stringFits(record.filename) &&
+                         snapshot.stringFits(record.location) && snapshot.stringFits(record.description) &&
+                         record.firstTag <= header.tagCount && record.tagCount <= header.tagCount - record.firstTag;
+            for (uint32_t t = 0; valid && t < record.tagCount; t++) {
+                valid = snapshot.stringFits(tags[record.firstTag + t]);
+            }
+            if (!valid) {
+                cerr << "Ignoring damaged snapshot: " << snapshotPath << endl;
+                idIndex.clear();
+                store.clear();
+                snapshot.close();
+                return false;
+            }
+            
+            Photo photo(record.id, snapshot.getString(record.filename), snapshot.getString(record.location),
+                        record.dateTime, snapshot.getString(record.description), record.fileSize, record.viewCount);
+            for (uint32_t t = 0; t < record.tagCount; t++) {
+                photo.addTag(snapshot.getString(tags[record.firstTag + t]));
+            }
+            
+            // The store is empty, so record i gets handle i
+            indexPhotoId(record.id, store.add(photo));
+            previousId = record.id;
+        }
+        
+        // The popularity order in the file is checked against these counts
+        // before it is used, so a stale one is simply rebuilt
+        if (header.viewChangeCount != viewChangeCount) {
+            refreshViewCounts();
+        }
+        return true;
+    }
+    
+    // Write the store as a snapshot tagged with the given database state.
+    // The file is written under a temporary name and renamed into place, so
+    // readers see either the old snapshot or the complete new one.
+    bool writeSnapshot(long long changeCount, long long viewChangeCount, const string& databaseId) {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.photoRecordSize = sizeof(SnapshotPhoto);
+        header.changeCount = changeCount;
+        header.viewChangeCount = viewChangeCount;
+        memcpy(header.databaseId, databaseId.data(), SNAPSHOT_DATABASE_ID_BYTES);
+        
+        // Interned values (file names, locations, tags) are written once per
+        // symbol; descriptions are mostly unique and are appended as they come
+        string strings;
+        unordered_map<Symbol, SnapshotString> pooled;
+        auto append = [&](const char* value, size_t length) -> SnapshotString {
+            SnapshotString ref = { (uint32_t)strings.length(), (uint32_t)length };
+            strings.append(value, length);
+            return ref;
+        };
+        auto intern = [&](Symbol symbol) -> SnapshotString {
+            unordered_map<Symbol, SnapshotString>::iterator it = pooled.find(symbol);
+            if (it != pooled.end()) return it->second;
+            return pooled[symbol] = append(stringPool().c_str(symbol), stringPool().length(symbol));
+        };
+        
+        vector<SnapshotPhoto> records;
+        vector<SnapshotString> tags;
+        unordered_map<Symbol, vector<int32_t> > tagPostings;
+        unordered_map<Symbol, vector<int32_t> > locationPostings;
+        records.reserve(store.size());
+        forEachPhoto([&](const Photo* photo) {
+            SnapshotPhoto record;
+            memset(&record, 0, sizeof(record));
+            record.dateTime = photo->getDateTime();
+            record.id = photo->getId();
+            record.fileSize = photo->getFileSize();
+            record.viewCount = photo->getViewCount();
+            record.tagCount = photo->getTagCount();
+            record.firstTag = tags.size();
+            record.filename = intern(photo->getFilenameSymbol());
+            record.location = intern(photo->getLocationSymbol());
+            string description = photo->getDescription();
+            record.description = append(description.data(), description.length());
+            for (int t = 0; t < photo->getTagCount(); t++) {
+                tags.push_back(intern(photo->getTagSymbol(t)));
+                tagPostings[photo->getTagSymbol(t)].push_back(photo->getId());
+            }
+            locationPostings[photo->getLocationSymbol()].push_back(photo->getId());
+            records.push_back(record);
+        });
+        if (strings.length() > numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        
+        // Record indexes in date and view count order, ties by index, which is
+        // photo ID order like the AVL trees' tie-break
+        vector<int32_t> dateOrder(records.size());
+        vector<int32_t> popularityOrder(records.size());
+        for (size_t i = 0; i < records.size(); i++) {
+            dateOrder[i] = popularityOrder[i] = i;
+        }
+        sort(dateOrder.begin(), dateOrder.end(), [&](int32_t a, int32_t b) {
+            return records[a].dateTime != records[b].dateTime ? records[a].dateTime < records[b].dateTime : a < b;
+        });
+        sort(popularityOrder.begin(), popularityOrder.end(), [&](int32_t a, int32_t b) {
+            return records[a].viewCount != records[b].viewCount ? records[a].viewCount < records[b].viewCount : a < b;
+        });
+        
+        vector<SnapshotPosting> postings[2];
+        vector<int32_t> postingIds;
+        unordered_map<Symbol, vector<int32_t> >* sources[2] = { &tagPostings, &locationPostings };
+        for (int k = 0; k < 2; k++) {
+            for (unordered_map<Symbol, vector<int32_t> >::iterator it = sources[k]->begin(); it != sources[k]->end(); ++it) {
+                SnapshotPosting posting = { intern(it->first), (uint32_t)postingIds.size(), (uint32_t)it->second.size() };
+                postings[k].push_back(posting);
+                postingIds.insert(postingIds.end(), it->second.begin(), it->second.end());
+            }
+        }
+        
+        // Lay the sections out after the header, each 8-byte aligned
+        uint64_t offset = sizeof(SnapshotHeader);
+        auto place = [&](uint64_t& sectionOffset, uint64_t bytes) {
+            offset = (offset + 7) & ~(uint64_t)7;
+            sectionOffset = offset;
+            offset += bytes;
+        };
+        header.photoCount = records.size();
+        header.tagCount = tags.size();
+        header.tagPostingCount = postings[0].size();
+        header.locationPostingCount = postings[1].size();
+        header.postingIdCount = postingIds.size();
+        header.stringBytes = strings.length();
+        place(header.photosOffset, records.size() * sizeof(SnapshotPhoto));
+        place(header.tagsOffset, tags.size() * sizeof(SnapshotString));
+        place(header.dateOrderOffset, dateOrder.size() * sizeof(int32_t));
+        place(header.popularityOrderOffset, popularityOrder.size() * sizeof(int32_t));
+        place(header.tagPostingsOffset, postings[0].size() * sizeof(SnapshotPosting));
+        place(header.locationPostingsOffset, postings[1].size() * sizeof(SnapshotPosting));
+        place(header.postingIdsOffset, postingIds.size() * sizeof(int32_t));
+        place(header.stringsOffset, strings.length());
+        header.fileSize = (offset + 7) & ~(uint64_t)7;
+        
+        string image(header.fileSize, '\0');
+        auto copy = [&](uint64_t sectionOffset, const void* bytes, size_t length) {
+            if (length > 0) memcpy(&image[sectionOffset], bytes, length);
+        };
+        copy(header.photosOffset, records.data(), records.size() * sizeof(SnapshotPhoto));
+        copy(header.tagsOffset, tags.data(), tags.size() * sizeof(SnapshotString));
+        copy(header.dateOrderOffset, dateOrder.data(), dateOrder.size() * sizeof(int32_t));
+        copy(header.popularityOrderOffset, popularityOrder.data(), popularityOrder.size() * sizeof(int32_t));
+        copy(header.tagPostingsOffset, postings[0].data(), postings[0].size() * sizeof(SnapshotPosting));
+        copy(header.locationPostingsOffset, postings[1].data(), postings[1].size() * sizeof(SnapshotPosting));
+        copy(header.postingIdsOffset, postingIds.data(), postingIds.size() * sizeof(int32_t));
+        copy(header.stringsOffset, strings.data(), strings.length());
+        header.checksum = snapshotChecksum(image.data() + sizeof(SnapshotHeader), image.size() - sizeof(SnapshotHeader));
+        copy(0, &header, sizeof(header));
+        
+        string tempPath = snapshotPath + ".tmp";
+        ofstream file(tempPath.c_str(), ios::binary | ios::trunc);
+        file.write(image.data(), image.size());
+        file.close();
+        
+        if (!file || rename(tempPath.c_str(), snapshotPath.c_str()) != 0) {
+            cerr << "Failed to write snapshot: " << snapshotPath << endl;
+            ::remove(tempPath.c_str());
+            return false;
+        }
+        return true;
+    }
+    
+    // Build the date tree, popularity tree, tag postings or location map
+    // straight from the open snapshot's sections. Returns false, leaving the
+    // structure untouched, for other indexes or if a section is inconsistent.
+    bool buildIndexFromSnapshot(GalleryIndex index) {
+        const SnapshotHeader& header = snapshot.header();
+        
+        if (index == INDEX_DATE_TREE || index == INDEX_POPULARITY_TREE) {
+            const int32_t* order = snapshot.section<int32_t>(index == INDEX_DATE_TREE ? header.dateOrderOffset
+                                                                                      : header.popularityOrderOffset);
+            auto keyOf = [&](PhotoHandle handle) -> long long {
+                Photo* photo = store.get(handle);
+                return index == INDEX_DATE_TREE ? (long long)photo->getDateTime() : photo->getViewCount();
+            };
+            auto idOf = [&](PhotoHandle handle) { return store.get(handle)->getId(); };
+            for (uint32_t i = 0; i < header.photoCount; i++) {
+                if (order[i] < 0 || order[i] >= (int32_t)header.photoCount) return false;
+                if (i > 0 && !(keyOf(order[i - 1]) < keyOf(order[i]) ||
+                               (keyOf(order[i - 1]) == keyOf(order[i]) && idOf(order[i - 1]) < idOf(order[i])))) {
+                    return false;
+                }
+            }
+            (index == INDEX_DATE_TREE ? dateTree : popularityTree).buildSorted(order, header.photoCount, keyOf, idOf);
+            return true;
+        }
+        
+        if (index != INDEX_TAG_POSTINGS && index != INDEX_LOCATION_MAP) {
+            return false;
+        }
+        bool tags = (index == INDEX_TAG_POSTINGS);
+        const SnapshotPosting* postings = snapshot.section<SnapshotPosting>(tags ? header.tagPostingsOffset
+                                                                                 : header.locationPostingsOffset);
+        uint32_t postingCount = tags ? header.tagPostingCount : header.locationPostingCount;
+        const int32_t* ids = snapshot.section<int32_t>(header.postingIdsOffset);
+        for (uint32_t p = 0; p < postingCount; p++) {
+            const SnapshotPosting& posting = postings[p];
+            if (!snapshot.stringFits(posting.key) || posting.first > header.postingIdCount ||
+                posting.count > header.postingIdCount - posting.first) {
+                return false;
+            }
+            for (uint32_t i = 0; i < posting.count; i++) {
+                int id = ids[posting.first + i];
+                if (handleForId(id) == NO_PHOTO || (i > 0 && id <= ids[posting.first + i - 1])) return false;
+            }
+        }
+        
+        for (uint32_t p = 0; p < postingCount; p++) {
+            const SnapshotPosting& posting = postings[p];
+            Symbol key = stringPool().intern(snapshot.getString(posting.key));
+            if (tags) {
+                tagIndex.setPostings(key, ids + posting.first, posting.count);
+            } else {
+                locationMap.setPostings(key, ids + posting.first, posting.count);
+            }
+        }
+        return true;
+    }
+    
+    // Record a photo in the primary key index. IDs come from AUTOINCREMENT,
+    // so a dense array indexed by ID stays small and lookups are one load.
+    void indexPhotoId(int photoId, PhotoHandle handle) {
+        if (photoId < 0) return;
+        if (photoId >= (int)idIndex.size()) {
+            idIndex.resize(photoId + 1, NO_PHOTO);
+        }
+        idIndex[photoId] = handle;
+    }
+    
+    // Keep the case-folded copy of a photo's description current
+    void foldDescription(const Photo& photo) {
+        if (photo.getId() >= (int)foldedDescriptions.size()) {
+            foldedDescriptions.resize(photo.getId() + 1);
+        }
+        foldedDescriptions[photo.getId()] = foldCase(photo.getDescription());
+    }
+    
+    // Add one stored photo to one secondary index
+    void addToIndex(GalleryIndex index, PhotoHandle handle) {
+        Photo* photo = store.get(handle);
+        int photoId = photo->getId();
+        
+        switch (index) {
+            case INDEX_FOLDED_DESCRIPTIONS: foldDescription(*photo); break;
+            case INDEX_TAG_TRIE:
+                for (int i = 0; i < photo->getTagCount(); i++) {
+                    tagTrie.insert(photo->getTag(i), photoId);
+                }
+                break;
+            case INDEX_TAG_POSTINGS: tagIndex.addPhoto(*photo); break;
+            case INDEX_TEXT: textIndex.addPhoto(*photo); break;
+            case INDEX_ID_TREE: idTree.insert(photoId, photoId, handle); break;
+            case INDEX_DATE_TREE: dateTree.insert(photo->getDateTime(), photoId, handle); break;
+            case INDEX_SIZE_TREE: sizeTree.insert(photo->getFileSize(), photoId, handle); break;
+            case INDEX_POPULARITY_TREE: popularityTree.insert(photo->getViewCount(), photoId, handle); break;
+            case INDEX_RECENT_QUEUE: recentQueue.insert(photo); break;
+            case INDEX_POPULAR_QUEUE: popularQueue.insert(photo); break;
+            case INDEX_LOCATION_MAP: locationMap.insert(photo->getLocationSymbol(), photoId); break;
+            case INDEX_PHOTO_LIST: photoList.append(photo); break;
+            case INDEX_PHOTO_TABLE: photoTable.set(handle, *photo); break;
+            case INDEX_GEO: geoIndex.addPhoto(*photo); break;
+            default: break;
+        }
+    }
+    
+    // Remove one stored photo from one secondary index
+    void removeFromIndex(GalleryIndex index, PhotoHandle handle) {
+        Photo* photo = store.get(handle);
+        int photoId = photo->getId();
+        
+        switch (index) {
+            case INDEX_FOLDED_DESCRIPTIONS: string().swap(foldedDescriptions[photoId]); break;
+            case INDEX_TAG_TRIE:
+                for (int i = 0; i < photo->getTagCount(); i++) {
+                    tagTrie.remove(photo->getTag(i), photoId);
+                }
+                break;
+            case INDEX_TAG_POSTINGS: tagIndex.removePhoto(*photo); break;
+            case INDEX_TEXT: textIndex.removePhoto(*photo); break;
+            case INDEX_LOCATION_MAP: locationMap.remove(photo->getLocationSymbol(), photoId); break;
+            case INDEX_ID_TREE: idTree.remove(photoId, photoId); break;
+            case INDEX_DATE_TREE: dateTree.remove(photo->getDateTime(), photoId); break;
+            case INDEX_SIZE_TREE: sizeTree.remove(photo->getFileSize(), photoId); break;
+            case INDEX_POPULARITY_TREE: popularityTree.remove(photo->getViewCount(), photoId); break;
+            case INDEX_RECENT_QUEUE: recentQueue.remove(photo); break;
+            case INDEX_POPULAR_QUEUE: popularQueue.remove(photo); break;
+            case INDEX_PHOTO_LIST: photoList.remove(photo); break;
+            case INDEX_PHOTO_TABLE: photoTable.erase(handle); break;
+            case INDEX_GEO: geoIndex.removePhoto(*photo); break;
+            default: break;
+        }
+    }
+    
+    // The AVL tree behind a tree index (nullptr for other indexes) and the
+    // key a photo is filed under in it
+    AVLTree* treeFor(GalleryIndex index) {
+        switch (index) {
+            case INDEX_ID_TREE: return &idTree;
+            case INDEX_DATE_TREE: return &dateTree;
+            case INDEX_SIZE_TREE: return &sizeTree;
+            case INDEX_POPULARITY_TREE: return &popularityTree;
+            default: return nullptr;
+        }
+    }
+    
+    static long long treeKey(GalleryIndex index, const Photo& photo) {
+        switch (index) {
+            case INDEX_ID_TREE: return photo.getId();
+            case INDEX_DATE_TREE: return photo.getDateTime();
+            case INDEX_SIZE_TREE: return photo.getFileSize();
+            default: return photo.getViewCount();
+        }
+    }
+    
+    // The tree index that orders photos for a sort
+    static GalleryIndex sortTreeIndex(SortType sortType) {
+        switch (sortType) {
+            case BY_DATE: return INDEX_DATE_TREE;
+            case BY_SIZE: return INDEX_SIZE_TREE;
+            default: return INDEX_POPULARITY_TREE;
+        }
+    }
+    
+    // Build a tree index by sorting the handles into tree order and building
+    // the tree bottom-up, instead of one rebalancing insert per photo
+    void buildTreeIndex(GalleryIndex index) {
+        vector<pair<long long, int> > entries;
+        entries.reserve(store.size());
+        for (size_t id = 0; id < idIndex.size(); id++) {
+            if (idIndex[id] != NO_PHOTO) entries.push_back(make_pair(treeKey(index, *store.get(idIndex[id])), (int)id));
+        }
+        sort(entries.begin(), entries.end());
+        
+        vector<PhotoHandle> handles(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            handles[i] = idIndex[entries[i].second];
+        }
+        treeFor(index)->buildSorted(handles.data(), handles.size(), [&](PhotoHandle handle) {
+            return treeKey(index, *store.get(handle));
+        }, [&](PhotoHandle handle) {
+            return store.get(handle)->getId();
+        });
+    }
+    
+    // Build a secondary index from the store if no query has needed it yet.
+    // Photos go in in ID order, the order loading used to insert them.
+    void requireIndex(GalleryIndex index) {
+        if (indexes.isBuilt(index)) return;
+        
+        if (!snapshot.isOpen() || !buildIndexFromSnapshot(index)) {
+            if (treeFor(index) != nullptr) {
+                buildTreeIndex(index);
+            } else {
+                for (size_t id = 0; id < idIndex.size(); id++) {
+                    if (idIndex[id] != NO_PHOTO) addToIndex(index, idIndex[id]);
+                }
+            }
+        }
+        indexes.markBuilt(index);
+    }
+    
+    // Add a photo that is already in the store to the primary key index and
+    // every secondary index built so far
+    void indexPhoto(PhotoHandle handle) {
+        snapshot.close();
+        indexPhotoId(store.get(handle)->getId(), handle);
+        substringIndex.markChanged(store.get(handle)->getId());
+        for (int index = 0; index < GALLERY_INDEX_COUNT; index++) {
+            if (indexes.isBuilt((GalleryIndex)index)) addToIndex((GalleryIndex)index, handle);
+        }
+    }
+    
+    PhotoHandle handleForId(int photoId) const {
+        if (photoId < 0 || photoId >= (int)idIndex.size()) return NO_PHOTO;
+        return idIndex[photoId];
+    }
+    
+    // Visit every photo in ID order (the order they were loaded and added in)
+    template <typename Visitor>
+    void forEachPhoto(Visitor visit) {
+        for (size_t id = 0; id < idIndex.size(); id++) {
+            if (idIndex[id] != NO_PHOTO) visit(store.get(idIndex[id]));
+        }
+    }
+    
+    // SQL run through the statement cache
+    static const char* insertPhotoSql() {
+        return "INSERT INTO photos (filename, location, date_time, description, file_size, view_count, "
+               "latitude, longitude) "
+               "VALUES (?1, ?2, ?3, ?4, ?5, ?6, gallery_latitude(?2), gallery_longitude(?2));";
+    }
+    
+    static const char* insertTagNameSql() {
+        return "INSERT OR IGNORE INTO tag_names (name) VALUES (?);";
+    }
+    
+    static const char* insertTagSql() {
+        return "INSERT INTO tags (photo_id, tag, tag_id) "
+               "VALUES (?1, ?2, (SELECT id FROM tag_names WHERE name = ?2));";
+    }
+    
+    // Run a cached statement that returns no rows, reporting any failure
+    bool execute(sqlite3_stmt* stmt) {
+        int rc = sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
+            return false;
+        }
+        return true;
+    }
+    
+    // Insert one row per tag of a photo, adding new tags to tag_names first.
+    // Returns false at the first row that fails; the caller's savepoint
+    // undoes the rest.
+    bool insertTags(const Photo& photo) {
+        sqlite3_stmt* nameStmt = statements.get(insertTagNameSql());
+        sqlite3_stmt* stmt = statements.get(insertTagSql());
+        if (nameStmt == nullptr || stmt == nullptr) return false;
+        
+        for (int i = 0; i < photo.getTagCount(); i++) {
+            sqlite3_bind_text(nameStmt, 1, photo.getTag(i).c_str(), -1, SQLITE_TRANSIENT);
+            if (!execute(nameStmt)) {
+                return false;
+            }
+            
+            sqlite3_bind_int(stmt, 1, photo.getId());
+            sqlite3_bind_text(stmt, 2, photo.getTag(i).c_str(), -1, SQLITE_TRANSIENT);
+            if (!execute(stmt)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
     // Save photo to database
     int savePhotoToDB(Photo& photo) {
-        const char* sql = "INSERT INTO photos (filename, location, date_time, description, file_size, view_count) "
-                          "VALUES (?, ?, ?, ?, ?, ?);";
-                          
-        sqlite3_stmt* stmt;
-        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-        
-        if (rc != SQLITE_OK) {
-            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+        Savepoint write(statements);
+        sqlite3_stmt* stmt = statements.get(insertPhotoSql());
+        if (stmt == nullptr) {
             return -1;
         }
         
-        sqlite3_bind_text(stmt, 1, photo.getFilename().c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, photo.getLocation().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 1, photo.getFilename().c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, photo.getLocation().c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_int64(stmt, 3, photo.getDateTime());
-        sqlite3_bind_text(stmt, 4, photo.getDescription().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, photo.getDescription().c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_int(stmt, 5, photo.getFileSize());
         sqlite3_bind_int(stmt, 6, photo.getViewCount());
         
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            sqlite3_finalize(stmt);
+        if (!execute(stmt)) {
             return -1;
         }
         
         int photoId = sqlite3_last_insert_rowid(db);
         photo.setId(photoId);
         
-        sqlite3_finalize(stmt);
-        
-        // Save tags
-        for (int i = 0; i < photo.getTagCount(); i++) {
-            string tag = photo.getTag(i);
-            
-            const char* tagSql = "INSERT INTO tags (photo_id, tag) VALUES (?, ?);";
-            
-            rc = sqlite3_prepare_v2(db, tagSql, -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
-                continue;
-            }
-            
-            sqlite3_bind_int(stmt, 1, photoId);
-            sqlite3_bind_text(stmt, 2, tag.c_str(), -1, SQLITE_STATIC);
-            
-            rc = sqlite3_step(stmt);
-            if (rc != SQLITE_DONE) {
-                cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            }
-            
-            sqlite3_finalize(stmt);
+        // Save tags; if they fail, the photo row is rolled back with them
+        if (!insertTags(photo) || !write.release()) {
+            photo.setId(-1);
+            return -1;
         }
-        
         return photoId;
     }
     
     // Update photo in database
     bool updatePhotoInDB(const Photo& photo) {
-        const char* sql = "UPDATE photos SET filename = ?, location = ?, date_time = ?, "
-                          "description = ?, file_size = ?, view_count = ? WHERE id = ?;";
-                          
-        sqlite3_stmt* stmt;
-        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
-        
-        if (rc != SQLITE_OK) {
-            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+        Savepoint write(statements);
+        sqlite3_stmt* stmt = statements.get("UPDATE photos SET filename = ?1, location = ?2, date_time = ?3, "
+                                            "description = ?4, file_size = ?5, view_count = ?6, "
+                                            "latitude = gallery_latitude(?2), longitude = gallery_longitude(?2) "
+                                            "WHERE id = ?7;");
+        if (stmt == nullptr) {
             return false;
         }
         
-        sqlite3_bind_text(stmt, 1, photo.getFilename().c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, photo.getLocation().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 1, photo.getFilename().c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, photo.getLocation().c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_int64(stmt, 3, photo.getDateTime());
-        sqlite3_bind_text(stmt, 4, photo.getDescription().c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, photo.getDescription().c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_int(stmt, 5, photo.getFileSize());
         sqlite3_bind_int(stmt, 6, photo.getViewCount());
         sqlite3_bind_int(stmt, 7, photo.getId());
         
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            sqlite3_finalize(stmt);
+        if (!execute(stmt)) {
             return false;
         }
         
-        sqlite3_finalize(stmt);
-        
         // Delete existing tags and insert new ones
-        const char* deleteSql = "DELETE FROM tags WHERE photo_id = ?;";
-        rc = sqlite3_prepare_v2(db, deleteSql, -1, &stmt, nullptr);
-        
-        if (rc != SQLITE_OK) {
-            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+        stmt = statements.get("DELETE FROM tags WHERE photo_id = ?;");
+        if (stmt == nullptr) {
             return false;
         }
         
         sqlite3_bind_int(stmt, 1, photo.getId());
-        
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            sqlite3_finalize(stmt);
+        if (!execute(stmt)) {
             return false;
         }
         
-        sqlite3_finalize(stmt);
+        if (!insertTags(photo)) {
+            return false;
+        }
         
-        // Insert new tags
-        for (int i = 0; i < photo.getTagCount(); i++) {
-            string tag = photo.getTag(i);
-            
-            const char* tagSql = "INSERT INTO tags (photo_id, tag) VALUES (?, ?);";
-            
-            rc = sqlite3_prepare_v2(db, tagSql, -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
-                continue;
-            }
-            
-            sqlite3_bind_int(stmt, 1, photo.getId());
-            sqlite3_bind_text(stmt, 2, tag.c_str(), -1, SQLITE_STATIC);
-            
-            rc = sqlite3_step(stmt);
-            if (rc != SQLITE_DONE) {
-                cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            }
-            
-            sqlite3_finalize(stmt);
+        return write.release();
+    }
+    
+    // Save only the view count (views don't touch any other column or the tags)
+    bool updateViewCountInDB(const Photo& photo) {
+        sqlite3_stmt* stmt = statements.get("UPDATE photos SET view_count = ? WHERE id = ?;");
+        if (stmt == nullptr) {
+            return false;
         }
         
-        return true;
+        sqlite3_bind_int(stmt, 1, photo.getViewCount());
+        sqlite3_bind_int(stmt, 2, photo.getId());
+        
+        return execute(stmt);
     }
     
     // Delete photo from database
     bool deletePhotoFromDB(int photoId) {
-        // First delete tags
-        const char* deleteTags = "DELETE FROM tags WHERE photo_id = ?;";
-        sqlite3_stmt* stmt;
-        int rc = sqlite3_prepare_v2(db, deleteTags, -1, &stmt, nullptr);
+        Savepoint write(statements);
         
-        if (rc != SQLITE_OK) {
-            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+        // First delete tags
+        sqlite3_stmt* stmt = statements.get("DELETE FROM tags WHERE photo_id = ?;");
+        if (stmt == nullptr) {
             return false;
         }
         
         sqlite3_bind_int(stmt, 1, photoId);
-        
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            sqlite3_finalize(stmt);
+        if (!execute(stmt)) {
             return false;
         }
         
-        sqlite3_finalize(stmt);
-        
         // Then delete photo
-        const char* deletePhoto = "DELETE FROM photos WHERE id = ?;";
-        rc = sqlite3_prepare_v2(db, deletePhoto, -1, &stmt, nullptr);
-        
-        if (rc != SQLITE_OK) {
-            cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+        stmt = statements.get("DELETE FROM photos WHERE id = ?;");
+        if (stmt == nullptr) {
             return false;
         }
         
         sqlite3_bind_int(stmt, 1, photoId);
-        
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            cerr << "Execution failed: " << sqlite3_errmsg(db) << endl;
-            sqlite3_finalize(stmt);
+        if (!execute(stmt)) {
             return false;
         }
         
-        sqlite3_finalize(stmt);
-        return true;
+        return write.release();
     }
 
 public:
-    PhotoGallerySystem() : photoCount(0) {
+    PhotoGallerySystem(const string& dbPath = "photo_gallery.db",
+                       const string& profileName = DEFAULT_DATABASE_PROFILE)
+        : profile(findDatabaseProfile(profileName)), descriptionSearchCount(0), popularQueue(true),
+          tagSearchCount(0), locationSearchCount(0) {
+        if (profile == nullptr) {
+            cerr << "Unknown database profile: " << profileName << endl;
+            exit(1);
+        }
+        
         // Initialize database
-        if (!initDatabase()) {
+        if (!initDatabase(dbPath)) {
             cerr << "Failed to initialize database" << endl;
             exit(1);
         }
         
-        // Load photos from database
-        loadPhotosFromDB();
+        // Load photos from the snapshot if it is current, else from the
+        // database, reading the rows and the change counter in one
+        // transaction so that the snapshot written from them is consistent
+        if (dbPath != ":memory:" && !dbPath.empty()) {
+            snapshotPath = dbPath + ".snapshot";
+        }
+        if (!loadSnapshot()) {
+            long long changeCount = 0, viewChangeCount = 0;
+            string databaseId;
+            sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+            bool stateRead = readDatabaseState(changeCount, viewChangeCount, databaseId);
+            loadPhotosFromDB();
+            sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+            
+            if (stateRead && !snapshotPath.empty()) {
+                writeSnapshot(changeCount, viewChangeCount, databaseId);
+            }
+        }
     }
     
     ~PhotoGallerySystem() {
-        // Free memory for photos
-        for (int i = 0; i < photoCount; i++) {
-            delete photos[i];
-        }
-        
-        // Close database
+        // Close database (statements first, or the close fails)
+        statements.clear();
         sqlite3_close(db);
     }
     
@@ -1290,257 +4170,356 @@ public:
             return false;
         }
         
-        // Create a new photo with the ID
-        Photo* newPhoto = new Photo(photoId, filename, location, dateTime, description, fileSize, 0);
-        newPhoto->setTags(tagsStr);
+        // Store the photo with its new ID and add it to data structures
+        indexPhoto(store.add(photo));
+        
+        return true;
+    }
+    
+    // Add many photos at once: every row goes in inside one transaction
+    // through one prepared statement per table, and the in-memory indexes are
+    // only updated after the commit, in one pass. Photos receive their new
+    // IDs; a photo whose row failed keeps ID -1 and is skipped. Returns the
+    // number imported, or -1 if the transaction could not be begun or
+    // committed (then nothing was imported).
+    int importPhotos(vector<Photo>& photos) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(db, "BEGIN;", nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            cerr << "SQL error: " << errMsg << endl;
+            sqlite3_free(errMsg);
+            return -1;
+        }
         
-        // Add to data structures
-        photos[photoCount++] = newPhoto;
-        photoList.append(newPhoto);
-        dateTree.insert(*newPhoto);
-        popularityTree.insert(*newPhoto, false);
-        recentQueue.insert(newPhoto);
-        popularQueue.insert(newPhoto);
-        locationMap.insert(location, photoId);
+        int imported = 0;
+        for (size_t i = 0; i < photos.size(); i++) {
+            photos[i].setId(-1);
+            if (savePhotoToDB(photos[i]) != -1) {
+                imported++;
+            }
+        }
         
-        // Add tags to trie
-        for (int i = 0; i < newPhoto->getTagCount(); i++) {
-            tagTrie.insert(newPhoto->getTag(i), photoId);
+        if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            cerr << "SQL error: " << errMsg << endl;
+            sqlite3_free(errMsg);
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return -1;
         }
         
-        return true;
+        store.reserve(store.size() + imported);
+        for (size_t i = 0; i < photos.size(); i++) {
+            if (photos[i].getId() != -1) {
+                indexPhoto(store.add(photos[i]));
+            }
+        }
+        return imported;
     }
     
     // View a photo (increment view count)
-    bool viewPhoto(int index) {
-        if (index < 0 || index >= photoCount) {
+    bool viewPhoto(int photoId) {
+        PhotoHandle handle = handleForId(photoId);
+        Photo* photo = store.get(handle);
+        if (photo == nullptr) {
             return false;
         }
         
-        photos[index]->incrementViewCount();
-        
-        // Update in database
-        updatePhotoInDB(*photos[index]);
+        snapshot.close();
         
-        // Rebuild popularity tree & queue
-        popularityTree.rebuild(photos, photoCount, false);
+        // Take the photo out of the popularity tree under its old key,
+        // bump the count, then put it back under the new one
+        bool treeBuilt = indexes.isBuilt(INDEX_POPULARITY_TREE);
+        if (treeBuilt) popularityTree.remove(photo->getViewCount(), photoId);
+        photo->incrementViewCount();
+        if (treeBuilt) popularityTree.insert(photo->getViewCount(), photoId, handle);
+        if (indexes.isBuilt(INDEX_POPULAR_QUEUE)) popularQueue.update(photo);
+        if (indexes.isBuilt(INDEX_PHOTO_TABLE)) photoTable.setViewCount(handle, photo->getViewCount());
         
-        // Clear and rebuild popular queue
-        popularQueue.clear();
-        for (int i = 0; i < photoCount; i++) {
-            popularQueue.insert(photos[i]);
-        }
+        // Update in database
+        updateViewCountInDB(*photo);
         
         return true;
     }
     
     // Delete a photo
-    bool deletePhoto(int index) {
-        if (index < 0 || index >= photoCount) {
+    bool deletePhoto(int photoId) {
+        PhotoHandle handle = handleForId(photoId);
+        if (handle == NO_PHOTO) {
             return false;
         }
         
-        int photoId = photos[index]->getId();
-        
         // Delete from database
         if (!deletePhotoFromDB(photoId)) {
             return false;
         }
         
-        // Remove the photo from memory
-        delete photos[index];
-        
-        // Shift all photos
-        for (int i = index; i < photoCount - 1; i++) {
-            photos[i] = photos[i + 1];
+        // Remove the photo from each built structure, then from memory
+        snapshot.close();
+        substringIndex.markChanged(photoId);
+        for (int index = 0; index < GALLERY_INDEX_COUNT; index++) {
+            if (indexes.isBuilt((GalleryIndex)index)) removeFromIndex((GalleryIndex)index, handle);
         }
-        photoCount--;
-        
-        // Rebuild all data structures (simple approach)
-        dateTree.rebuild(photos, photoCount);
-        popularityTree.rebuild(photos, photoCount, false);
         
-        // Rebuild queues
-        recentQueue.clear();
-        popularQueue.clear();
-        for (int i = 0; i < photoCount; i++) {
-            recentQueue.insert(photos[i]);
-            popularQueue.insert(photos[i]);
-        }
+        store.remove(handle);
+        idIndex[photoId] = NO_PHOTO;
         
-        // For simplicity, rebuild the LinkedList
-        // (In a real implementation, we'd find and remove the specific node)
-        photoList = LinkedList();
-        for (int i = 0; i < photoCount; i++) {
-            photoList.append(photos[i]);
+        return true;
+    }
+    
+    // Whether a search should scan the photo table rather than build the
+    // index it would otherwise use. Only the first such search scans, and
+    // only if the index is not already built or available from the snapshot:
+    // filling the table copies a few fields per photo, far less work than
+    // building the index, which repeated searches then reuse.
+    bool scanTableFor(GalleryIndex index, int& searchCount) {
+        if (indexes.isBuilt(index) || snapshot.isOpen() || ++searchCount >= 2) {
+            return false;
         }
-        
+        requireIndex(INDEX_PHOTO_TABLE);
         return true;
     }
     
+    void appendPhotos(const vector<int>& photoIds, vector<Photo*>& results) {
+        results.reserve(results.size() + photoIds.size());
+        for (size_t i = 0; i < photoIds.size(); i++) {
+            results.push_back(getPhotoById(photoIds[i]));
+        }
+    }
+    
     // Search by location
-    void searchByLocation(const string& location, Photo** results, int& count) {
-        count = 0;
-        int* photoIds;
-        int idCount;
-        
-        photoIds = locationMap.get(location, idCount);
-        
-        for (int i = 0; i < idCount; i++) {
-            for (int j = 0; j < photoCount; j++) {
-                if (photos[j]->getId() == photoIds[i]) {
-                    results[count++] = photos[j];
-                    break;
-                }
-            }
+    void searchByLocation(const string& location, vector<Photo*>& results) {
+        results.clear();
+        
+        if (scanTableFor(INDEX_LOCATION_MAP, locationSearchCount)) {
+            Symbol symbol = stringPool().find(location);
+            vector<int> ids;
+            if (symbol != NO_SYMBOL) photoTable.findLocation(symbol, ids);
+            appendPhotos(ids, results);
+            return;
         }
         
-        delete[] photoIds;
+        // The map holds exactly the live photos at each location
+        requireIndex(INDEX_LOCATION_MAP);
+        const vector<int>* photoIds = locationMap.find(location);
+        if (photoIds != nullptr) appendPhotos(*photoIds, results);
     }
     
     // Search by tag
-    void searchByTag(const string& tag, Photo** results, int& count) {
-        count = 0;
+    void searchByTag(const string& tag, vector<Photo*>& results) {
+        results.clear();
+        
+        if (scanTableFor(INDEX_TAG_POSTINGS, tagSearchCount)) {
+            Symbol symbol = stringPool().find(tag);
+            vector<int> ids;
+            if (symbol != NO_SYMBOL) photoTable.findTag(symbol, store, ids);
+            appendPhotos(ids, results);
+            return;
+        }
         
-        for (int i = 0; i < photoCount; i++) {
-            if (photos[i]->hasTag(tag)) {
-                results[count++] = photos[i];
+        requireIndex(INDEX_TAG_POSTINGS);
+        const vector<int>* photoIds = tagIndex.find(tag);
+        if (photoIds == nullptr) return;
+        
+        results.reserve(photoIds->size());
+        for (size_t i = 0; i < photoIds->size(); i++) {
+            results.push_back(getPhotoById((*photoIds)[i]));
+        }
+    }
+    
+    // Search by a parsed boolean tag query
+    void searchByTagQuery(TagQuery& query, vector<Photo*>& results) {
+        results.clear();
+        
+        vector<int> allIds;
+        if (query.needsAllIds()) {
+            for (size_t id = 0; id < idIndex.size(); id++) {
+                if (idIndex[id] != NO_PHOTO) allIds.push_back(id);
             }
         }
+        
+        vector<int> photoIds;
+        requireIndex(INDEX_TAG_POSTINGS);
+        query.evaluate(tagIndex, allIds, photoIds);
+        
+        results.reserve(photoIds.size());
+        for (size_t i = 0; i < photoIds.size(); i++) {
+            results.push_back(getPhotoById(photoIds[i]));
+        }
     }
     
     // Search by date range
-    void searchByDateRange(const string& startDateStr, const string& endDateStr, Photo** results, int& count) {
+    void searchByDateRange(const string& startDateStr, const string& endDateStr, vector<Photo*>& results) {
         time_t startDate = stringToTime(startDateStr);
         time_t endDate = stringToTime(endDateStr);
         
-        count = 0;
-        Photo** dateResults = dateTree.searchByDateRange(startDate, endDate, count);
+        vector<PhotoHandle> handles;
+        requireIndex(INDEX_DATE_TREE);
+        dateTree.searchByKeyRange(startDate, endDate, handles);
         
-        for (int i = 0; i < count; i++) {
-            results[i] = dateResults[i];
+        results.clear();
+        for (size_t i = 0; i < handles.size(); i++) {
+            results.push_back(store.get(handles[i]));
         }
-        
-        delete[] dateResults;
+    }
+    
+    // Search for photos taken within radiusKm of a point, nearest first
+    void searchNear(double latitude, double longitude, double radiusKm, vector<Photo*>& results) {
+        vector<int> photoIds;
+        requireIndex(INDEX_GEO);
+        geoIndex.searchNear(latitude, longitude, radiusKm, photoIds);
+        
+        results.clear();
+        appendPhotos(photoIds, results);
+    }
+    
+    // Search for photos taken inside a latitude/longitude box
+    void searchBoundingBox(double minLat, double minLon, double maxLat, double maxLon, vector<Photo*>& results) {
+        vector<int> photoIds;
+        requireIndex(INDEX_GEO);
+        geoIndex.searchBox(minLat, minLon, maxLat, maxLon, photoIds);
+        
+        results.clear();
+        appendPhotos(photoIds, results);
     }
     
     // Search by keyword prefix using Trie
-    void searchByPrefix(const string& prefix, Photo** results, int& count) {
-        int* photoIds = tagTrie.searchByPrefix(prefix, count);
-        
-        int resultCount = 0;
-        for (int i = 0; i < count; i++) {
-            for (int j = 0; j < photoCount; j++) {
-                if (photos[j]->getId() == photoIds[i]) {
-                    bool exists = false;
-                    for (int k = 0; k < resultCount; k++) {
-                        if (results[k]->getId() == photos[j]->getId()) {
-                            exists = true;
-                            break;
-                        }
-                    }
-                    if (!exists) {
-                        results[resultCount++] = photos[j];
-                    }
-                    break;
-                }
+    void searchByPrefix(const string& prefix, vector<Photo*>& results) {
+        vector<int> photoIds;
+        requireIndex(INDEX_TAG_TRIE);
+        tagTrie.searchByPrefix(prefix, photoIds);
+        
+        results.clear();
+        for (size_t i = 0; i < photoIds.size(); i++) {
+            // Trie results are already unique per photo ID
+            Photo* photo = getPhotoById(photoIds[i]);
+            if (photo != nullptr) {
+                results.push_back(photo);
             }
         }
-        
-        count = resultCount;
-        delete[] photoIds;
     }
     
-    // Search by description text using KMP algorithm
-    void searchByDescription(const string& text, Photo** results, int& count) {
-        count = 0;
-        
-        for (int i = 0; i < photoCount; i++) {
-            string description = photos[i]->getDescription();
-            // Convert both to lowercase for case-insensitive search
-            string lowerDesc = description;
-            string lowerText = text;
-            
-            for (size_t j = 0; j < lowerDesc.length(); j++) {
-                lowerDesc[j] = tolower(lowerDesc[j]);
-            }
-            
-            for (size_t j = 0; j < lowerText.length(); j++) {
-                lowerText[j] = tolower(lowerText[j]);
-            }
-            
-            if (KMPSearch(lowerDesc, lowerText)) {
-                results[count++] = photos[i];
-            }
+    // Search descriptions for words, prefixes and phrases using the
+    // full-text index, e.g. "sunset beach*" or "\"old town\" market"
+    void searchByText(const string& query, vector<Photo*>& results) {
+        vector<int> photoIds;
+        requireIndex(INDEX_TEXT);
+        textIndex.search(query, [this](int photoId) { return getPhotoById(photoId); }, photoIds);
+        
+        results.clear();
+        results.reserve(photoIds.size());
+        for (size_t i = 0; i < photoIds.size(); i++) {
+            results.push_back(getPhotoById(photoIds[i]));
         }
     }
     
-    // Sort photos by date
-    void sortByDate(Photo** results, bool descending = true) {
-        for (int i = 0; i < photoCount; i++) {
-            results[i] = photos[i];
+    // Search by description substring (case-insensitive). A one-off search
+    // scans the pre-folded descriptions; the suffix array only repays its
+    // build over repeated searches in one process, so it is used from the
+    // second search on.
+    void searchByDescription(const string& text, vector<Photo*>& results) {
+        results.clear();
+        
+        // Fold the query once; descriptions were folded when loaded
+        string pattern = foldCase(text);
+        vector<int> photoIds;
+        requireIndex(INDEX_FOLDED_DESCRIPTIONS);
+        
+        if (++descriptionSearchCount < 2 && !substringIndex.isBuilt()) {
+            for (size_t id = 0; id < idIndex.size(); id++) {
+                if (idIndex[id] != NO_PHOTO && containsFolded(foldedDescriptions[id], pattern)) {
+                    photoIds.push_back(id);
+                }
+            }
+        } else {
+            if (substringIndex.needsRebuild()) {
+                substringIndex.beginBuild();
+                for (size_t id = 0; id < idIndex.size(); id++) {
+                    if (idIndex[id] != NO_PHOTO) substringIndex.addDocument(id, foldedDescriptions[id]);
+                }
+                substringIndex.endBuild();
+            }
+            substringIndex.search(pattern, [this](int photoId) -> const string* {
+                return handleForId(photoId) == NO_PHOTO ? nullptr : &foldedDescriptions[photoId];
+            }, photoIds);
         }
         
-        quickSort(results, 0, photoCount - 1, BY_DATE);
-        
-        if (!descending) {
-            // Reverse the array
-            for (int i = 0; i < photoCount / 2; i++) {
-                swap(results[i], results[photoCount - i - 1]);
-            }
+        results.reserve(photoIds.size());
+        for (size_t i = 0; i < photoIds.size(); i++) {
+            results.push_back(getPhotoById(photoIds[i]));
         }
     }
     
-    // Sort photos by size
-    void sortBySize(Photo** results, bool descending = true) {
-        for (int i = 0; i < photoCount; i++) {
-            results[i] = photos[i];
-        }
-        
-        quickSort(results, 0, photoCount - 1, BY_SIZE);
-        
-        if (!descending) {
-            // Reverse the array
-            for (int i = 0; i < photoCount / 2; i++) {
-                swap(results[i], results[photoCount - i - 1]);
-            }
+    // Sort every photo on one column of the photo table
+    void sortPhotos(SortType sortType, bool descending, vector<Photo*>& results) {
+        vector<PhotoHandle> rows;
+        requireIndex(INDEX_PHOTO_TABLE);
+        photoTable.sortRows(sortType, descending, rows);
+        
+        results.clear();
+        results.reserve(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            results.push_back(store.get(rows[i]));
         }
     }
     
-    // Sort photos by popularity (view count)
-    void sortByPopularity(Photo** results, bool descending = true) {
-        for (int i = 0; i < photoCount; i++) {
-            results[i] = photos[i];
+    // One page of the photos sorted by date, size or view count: up to limit
+    // photos (all the rest if limit is negative) from position offset on,
+    // read from the matching order-statistic tree in O(log n + limit).
+    // Photos with equal keys are ordered by ID, as in a full sort.
+    void sortPhotosPage(SortType sortType, bool descending, int offset, int limit, vector<Photo*>& results) {
+        GalleryIndex index = sortTreeIndex(sortType);
+        vector<PhotoHandle> handles;
+        requireIndex(index);
+        treeFor(index)->getRange(offset, limit, !descending, handles);
+        
+        results.clear();
+        results.reserve(handles.size());
+        for (size_t i = 0; i < handles.size(); i++) {
+            results.push_back(store.get(handles[i]));
         }
-        
-        quickSort(results, 0, photoCount - 1, BY_VIEWS);
+    }
+    
+    // Position in sortPhotosPage()'s order just after the photo with this sort
+    // key and ID, for resuming a listing. If that photo is gone or has a new
+    // key, the position of the first photo with the key instead, so resuming
+    // repeats photos that share it rather than skipping any.
+    int sortPositionAfter(SortType sortType, bool descending, long long key, int photoId) {
+        GalleryIndex index = sortTreeIndex(sortType);
+        requireIndex(index);
+        AVLTree& tree = *treeFor(index);
+        PhotoHandle handle = handleForId(photoId);
+        bool found = (handle != NO_PHOTO && sortKey(sortType, *store.get(handle)) == key);
         
         if (!descending) {
-            // Reverse the array
-            for (int i = 0; i < photoCount / 2; i++) {
-                swap(results[i], results[photoCount - i - 1]);
-            }
+            return found ? tree.rank(key, photoId) + 1 : tree.rank(key);
         }
+        // Descending positions count down from the end of the ascending order
+        return tree.getSize() - (found ? tree.rank(key, photoId) : tree.rank(key + 1));
+    }
+    
+    // Sort photos by date
+    void sortByDate(vector<Photo*>& results, bool descending = true) {
+        sortPhotos(BY_DATE, descending, results);
+    }
+    
+    // Sort photos by size
+    void sortBySize(vector<Photo*>& results, bool descending = true) {
+        sortPhotos(BY_SIZE, descending, results);
+    }
+    
+    // Sort photos by popularity (view count)
+    void sortByPopularity(vector<Photo*>& results, bool descending = true) {
+        sortPhotos(BY_VIEWS, descending, results);
     }
     
     // Get most recent photos using priority queue
-    void getMostRecentPhotos(Photo** results, int& count, int limit = 5) {
-        PriorityQueue tempQueue = recentQueue;
-        count = min(limit, tempQueue.getSize());
-        
-        for (int i = 0; i < count; i++) {
-            results[i] = tempQueue.extractMax();
-        }
+    void getMostRecentPhotos(vector<Photo*>& results, int limit = 5) {
+        requireIndex(INDEX_RECENT_QUEUE);
+        recentQueue.getTop(limit, results);
     }
     
     // Get most popular photos using priority queue
-    void getMostPopularPhotos(Photo** results, int& count, int limit = 5) {
-        PriorityQueue tempQueue = popularQueue;
-        count = min(limit, tempQueue.getSize());
-        
-        for (int i = 0; i < count; i++) {
-            results[i] = tempQueue.extractMax();
-        }
+    void getMostPopularPhotos(vector<Photo*>& results, int limit = 5) {
+        requireIndex(INDEX_POPULAR_QUEUE);
+        popularQueue.getTop(limit, results);
     }
     
     // Display photo details
@@ -1571,72 +4550,169 @@ public:
     
     // Display all photos
     void displayAllPhotos() {
-        cout << "\n===== All Photos (" << photoCount << ") =====" << endl;
-        for (int i = 0; i < photoCount; i++) {
-            cout << "[" << i << "] ";
-            displayPhoto(photos[i]);
-        }
+        cout << "\n===== All Photos (" << getPhotoCount() << ") =====" << endl;
+        int index = 0;
+        forEachPhoto([&](Photo* photo) {
+            cout << "[" << index++ << "] ";
+            displayPhoto(photo);
+        });
     }
     
     // Get photo count
     int getPhotoCount() const {
-        return photoCount;
+        return store.size();
     }
     
-    // Get photo by index
-    Photo* getPhoto(int index) {
-        if (index >= 0 && index < photoCount) {
-            return photos[index];
-        }
-        return nullptr;
+    // Name of the database profile in use
+    string getProfileName() const {
+        return profile->name;
+    }
+    
+    // Get photo by ID using the primary key index (nullptr if not found)
+    Photo* getPhotoById(int photoId) {
+        return store.get(handleForId(photoId));
     }
     
     // Get all photos
-    void getAllPhotos(Photo** results) {
-        for (int i = 0; i < photoCount; i++) {
-            results[i] = photos[i];
+    void getAllPhotos(vector<Photo*>& results) {
+        results.clear();
+        results.reserve(getPhotoCount());
+        forEachPhoto([&](Photo* photo) {
+            results.push_back(photo);
+        });
+    }
+    
+    // One page of all photos in ID order, the way sortPhotosPage() pages sorts
+    void getPhotosPage(int offset, int limit, vector<Photo*>& results) {
+        vector<PhotoHandle> handles;
+        requireIndex(INDEX_ID_TREE);
+        idTree.getRange(offset, limit, true, handles);
+        
+        results.clear();
+        results.reserve(handles.size());
+        for (size_t i = 0; i < handles.size(); i++) {
+            results.push_back(store.get(handles[i]));
+        }
+    }
+    
+    // Up to limit photos with IDs greater than photoId, in ID order, read
+    // straight from the primary key index; continuing from the last ID
+    // returned walks every photo once without building the ID tree
+    void getPhotosAfter(int photoId, int limit, vector<Photo*>& results) {
+        results.clear();
+        for (size_t id = photoId < 0 ? 0 : (size_t)photoId + 1; id < idIndex.size() && (int)results.size() < limit; id++) {
+            if (idIndex[id] != NO_PHOTO) results.push_back(store.get(idIndex[id]));
         }
     }
     
     // Add tag to photo
-    bool addTagToPhoto(int index, const string& tag) {
-        if (index < 0 || index >= photoCount) {
+    bool addTagToPhoto(int photoId, const string& tag) {
+        Photo* photo = getPhotoById(photoId);
+        if (photo == nullptr) {
             return false;
         }
         
-        photos[index]->addTag(tag);
-        updatePhotoInDB(*photos[index]);
+        // Save first, from a copy, as updatePhoto() does
+        Photo updated(*photo);
+        updated.addTag(tag);
+        if (!updatePhotoInDB(updated)) {
+            return false;
+        }
+        
+        snapshot.close();
+        photo->addTag(tag);
+        
+        // Add to trie and tag index (addTag ignores tags past the tenth)
+        if (photo->hasTag(tag)) {
+            if (indexes.isBuilt(INDEX_TAG_TRIE)) tagTrie.insert(tag, photoId);
+            if (indexes.isBuilt(INDEX_TAG_POSTINGS)) tagIndex.add(tag, photoId);
+            if (indexes.isBuilt(INDEX_PHOTO_TABLE)) photoTable.set(handleForId(photoId), *photo);
+        }
+        
+        return true;
+    }
+    
+    // Update a photo's editable metadata and save it
+    bool updatePhoto(int photoId, const string& location, const string& description, const string& tagsStr) {
+        Photo* photo = getPhotoById(photoId);
+        if (photo == nullptr) {
+            return false;
+        }
+        
+        // Save first, from a copy, so that a failed write leaves the photo
+        // and the indexes as they were
+        Photo updated(*photo);
+        updated.setLocation(location);
+        updated.setDescription(description);
+        updated.setTags(tagsStr);
+        if (!updatePhotoInDB(updated)) {
+            return false;
+        }
+        
+        // Unindex the old location, tags and description before replacing them
+        snapshot.close();
+        PhotoHandle handle = handleForId(photoId);
+        const GalleryIndex edited[] = { INDEX_FOLDED_DESCRIPTIONS, INDEX_TAG_TRIE, INDEX_TAG_POSTINGS,
+                                        INDEX_TEXT, INDEX_PHOTO_TABLE, INDEX_GEO };
+        for (size_t i = 0; i < sizeof(edited) / sizeof(edited[0]); i++) {
+            if (indexes.isBuilt(edited[i])) removeFromIndex(edited[i], handle);
+        }
+        
+        Symbol oldLocation = photo->getLocationSymbol();
+        photo->setLocation(location);
+        photo->setDescription(description);
+        photo->setTags(tagsStr);
         
-        // Add to trie
-        tagTrie.insert(tag, photos[index]->getId());
+        // Index the new values
+        substringIndex.markChanged(photoId);
+        for (size_t i = 0; i < sizeof(edited) / sizeof(edited[0]); i++) {
+            if (indexes.isBuilt(edited[i])) addToIndex(edited[i], handle);
+        }
+        if (indexes.isBuilt(INDEX_LOCATION_MAP)) {
+            locationMap.move(photoId, oldLocation, photo->getLocationSymbol());
+        }
         
         return true;
     }
     
     // Get unique locations
-    void getUniqueLocations(string* locations, int& count) {
-        locationMap.getAllKeys(locations, count);
+    void getUniqueLocations(vector<string>& locations) {
+        requireIndex(INDEX_LOCATION_MAP);
+        locationMap.getAllKeys(locations);
     }
     
     // Get data structure stats
     void getDataStructureStats() {
         cout << "\n===== Data Structure Statistics =====" << endl;
-        cout << "Total Photos: " << photoCount << endl;
+        cout << "Total Photos: " << getPhotoCount() << endl;
+        cout << "Indexes Built: " << indexes.getBuiltCount() << " of " << GALLERY_INDEX_COUNT;
+        for (int index = 0, listed = 0; index < GALLERY_INDEX_COUNT; index++) {
+            if (!indexes.isBuilt((GalleryIndex)index)) continue;
+            cout << (listed++ == 0 ? " (" : ", ") << IndexRegistry::getName((GalleryIndex)index);
+        }
+        cout << (indexes.getBuiltCount() > 0 ? ")" : "") << endl;
+        
+        // The sizes below need these built
+        requireIndex(INDEX_DATE_TREE);
+        requireIndex(INDEX_RECENT_QUEUE);
+        requireIndex(INDEX_POPULAR_QUEUE);
+        requireIndex(INDEX_PHOTO_LIST);
+        requireIndex(INDEX_LOCATION_MAP);
         cout << "Date Tree Size: " << dateTree.getSize() << endl;
         cout << "Recent Queue Size: " << recentQueue.getSize() << endl;
         cout << "Popular Queue Size: " << popularQueue.getSize() << endl;
         cout << "Photo List Size: " << photoList.getSize() << endl;
         
         // Count unique locations
-        string locations[100];
-        int locationCount = 0;
-        locationMap.getAllKeys(locations, locationCount);
-        cout << "Unique Locations: " << locationCount << endl;
+        vector<string> locations;
+        locationMap.getAllKeys(locations);
+        cout << "Unique Locations: " << locations.size() << endl;
     }
 };
 
 
 using json = nlohmann::json;
+typedef chrono::steady_clock Clock;
 
 // Photo class and other data structures from your existing code
 // ...
@@ -1659,6 +4735,20 @@ string sanitizeString(const string& input) {
     return result;
 }
 
+// Parse exactly count comma-separated numbers
+bool parseNumberList(const string& text, double* values, int count) {
+    const char* p = text.c_str();
+    for (int i = 0; i < count; i++) {
+        char* end;
+        values[i] = strtod(p, &end);
+        if (end == p || values[i] != values[i]) return false;
+        while (isspace((unsigned char)*end)) end++;
+        if (*end != (i + 1 < count ? ',' : '\0')) return false;
+        p = end + 1;
+    }
+    return true;
+}
+
 // Helper function to convert photo to JSON
 json photoToJson(const Photo& photo) {
     json photoJson;
@@ -1673,20 +4763,219 @@ json photoToJson(const Photo& photo) {
     return photoJson;
 }
 
-// CLI entry point
-int main(int argc, char* argv[]) {
+// Build a photo from an NDJSON import record, which uses the photoToJson
+// keys ("tags" may also be an array). Throws if a field is missing or invalid.
+Photo photoFromJson(const json& record) {
+    string tagsStr;
+    if (record.contains("tags") && record["tags"].is_array()) {
+        for (const json& tag : record["tags"]) {
+            if (!tagsStr.empty()) tagsStr += ",";
+            tagsStr += tag.get<string>();
+        }
+    } else {
+        tagsStr = record.value("tags", "");
+    }
+    
+    int fileSize = 0;
+    if (record.contains("fileSize")) {
+        const json& size = record["fileSize"];
+        fileSize = size.is_string() ? atoi(size.get<string>().c_str()) : size.get<int>();
+    }
+    
+    Photo photo(-1, record.at("filename").get<string>(), record.value("location", ""),
+                stringToTime(record.at("dateTime").get<string>()), record.value("description", ""), fileSize, 0);
+    photo.setTags(tagsStr);
+    return photo;
+}
+
+// Split one CSV line into fields. Double quotes protect commas, and "" inside
+// quotes is a literal quote.
+vector<string> splitCsvLine(const string& line) {
+    vector<string> fields(1);
+    bool quoted = false;
+    for (size_t i = 0; i < line.length(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.length() && line[i + 1] == '"') {
+                fields.back() += '"';
+                i++;
+            } else if (c == '"') {
+                quoted = false;
+            } else {
+                fields.back() += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.push_back("");
+        } else {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+// Build a photo from CSV import fields in add_photo argument order:
+// filename,location,date,description,tags,fileSize
+Photo photoFromCsv(const vector<string>& fields) {
+    if (fields.size() < 6) {
+        throw runtime_error("expected 6 fields: filename,location,date,description,tags,fileSize");
+    }
+    
+    Photo photo(-1, fields[0], fields[1], stringToTime(fields[2]), fields[3], atoi(fields[5].c_str()), 0);
+    photo.setTags(fields[4]);
+    return photo;
+}
+
+// Run the query of a search command (search <type> <term>) into results.
+// Returns false, with the reason written to err, for an unknown type or a
+// malformed term.
+bool findPhotos(PhotoGallerySystem& gallery, const string& searchType, const string& searchTerm,
+                vector<Photo*>& results, ostream& err) {
+    if (searchType == "location") {
+        gallery.searchByLocation(searchTerm, results);
+    } else if (searchType == "tag") {
+        gallery.searchByTag(searchTerm, results);
+    } else if (searchType == "tags") {
+        // Boolean tag query, e.g. "beach AND sunset NOT people"
+        TagQuery query;
+        if (!query.parse(searchTerm)) {
+            err << "Invalid tag query: " << query.getError() << endl;
+            return false;
+        }
+        gallery.searchByTagQuery(query, results);
+    } else if (searchType == "date_range") {
+        // Requires two dates separated by comma
+        size_t commaPos = searchTerm.find(',');
+        if (commaPos != string::npos) {
+            string startDate = searchTerm.substr(0, commaPos);
+            string endDate = searchTerm.substr(commaPos + 1);
+            gallery.searchByDateRange(startDate, endDate, results);
+        } else {
+            err << "Date range search requires start,end format" << endl;
+            return false;
+        }
+    } else if (searchType == "description") {
+        gallery.searchByDescription(searchTerm, results);
+    } else if (searchType == "prefix") {
+        gallery.searchByPrefix(searchTerm, results);
+    } else if (searchType == "text") {
+        gallery.searchByText(searchTerm, results);
+    } else if (searchType == "near") {
+        // lat,lon,radius_km
+        double values[3];
+        if (!parseNumberList(searchTerm, values, 3) || fabs(values[0]) > 90 || fabs(values[1]) > 180 ||
+            values[2] < 0) {
+            err << "Near search requires lat,lon,radius_km" << endl;
+            return false;
+        }
+        gallery.searchNear(values[0], values[1], values[2], results);
+    } else if (searchType == "bbox") {
+        // min_lat,min_lon,max_lat,max_lon
+        double values[4];
+        if (!parseNumberList(searchTerm, values, 4) || fabs(values[0]) > 90 || fabs(values[2]) > 90 ||
+            fabs(values[1]) > 180 || fabs(values[3]) > 180) {
+            err << "Bounding box search requires min_lat,min_lon,max_lat,max_lon" << endl;
+            return false;
+        }
+        gallery.searchBoundingBox(values[0], values[1], values[2], values[3], results);
+    } else {
+        err << "Unknown search type" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Sort type of a sort command (date, size or popularity)
+bool parseSortType(const string& name, SortType& sortType) {
+    if (name == "date") {
+        sortType = BY_DATE;
+    } else if (name == "size") {
+        sortType = BY_SIZE;
+    } else if (name == "popularity") {
+        sortType = BY_VIEWS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Streamed listings (the stream command) write one photoToJson record per
+// line, STREAM_CHUNK photos at a time as they are read, so neither a JSON
+// array of the whole listing nor one large output string is built. Each
+// chunk is followed by {"cursor": "<token>"} naming the point just after its
+// last photo; passing the token back with --after resumes the listing there,
+// in this process or a later one. {"cursor": null} ends a complete listing.
+// Tokens:
+//   a<id>         get_all_photos: the photos with greater IDs
+//   s<key>:<id>   sort: the photos after the one with this sort key and ID;
+//                 equal keys are ordered by ID, so every process agrees on it
+//   r<position>   search: the results from this position on (the search is rerun)
+const int STREAM_CHUNK = 100;
+
+// Read a cursor token of the given kind: one number, or for sort tokens two
+bool parseCursor(const string& token, char kind, long long& first, long long& second) {
+    if (token.length() < 2 || token[0] != kind) return false;
+    const char* text = token.c_str() + 1;
+    char* end;
+    first = strtoll(text, &end, 10);
+    if (end == text) return false;
+    if (kind == 's') {
+        if (*end != ':') return false;
+        text = end + 1;
+        second = strtoll(text, &end, 10);
+        if (end == text) return false;
+    }
+    return *end == '\0';
+}
+
+// Write a listing from position start on, stopping after limit photos unless
+// limit is negative. fetch(position, count, photos) reads up to count photos
+// from a position; cursorAfter(photo, position) makes the token for the
+// point just after photo, which ends at position.
+template <typename Fetch, typename CursorAfter>
+void streamPhotos(ostream& out, int start, int limit, Fetch fetch, CursorAfter cursorAfter) {
+    vector<Photo*> chunk;
+    int position = start;
+    bool complete = false;
+    while (!complete && limit != 0) {
+        int count = (limit < 0) ? STREAM_CHUNK : min(STREAM_CHUNK, limit);
+        fetch(position, count, chunk);
+        complete = ((int)chunk.size() < count);
+        if (chunk.empty()) break;
+        
+        for (size_t i = 0; i < chunk.size(); i++) {
+            out << photoToJson(*chunk[i]).dump() << '\n';
+        }
+        position += chunk.size();
+        if (limit > 0) limit -= chunk.size();
+        
+        json cursor;
+        cursor["cursor"] = cursorAfter(*chunk.back(), position);
+        out << cursor.dump() << endl;  // flush, so the reader gets each chunk as it is written
+    }
+    if (complete) {
+        out << "{\"cursor\":null}" << endl;
+    }
+}
+
+// Run a single CLI command against an already loaded gallery.
+// argv[0] is the program name and argv[1] the command, exactly as in main().
+// in is only read by import when no file is given.
+int runCommand(PhotoGallerySystem& gallery, const vector<string>& argv, ostream& out, ostream& err,
+               istream& in = cin) {
+    int argc = argv.size();
     if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " <command> [arguments...]" << endl;
+        err << "Usage: " << argv[0] << " <command> [arguments...]" << endl;
         return 1;
     }
     
     string command = argv[1];
-    PhotoGallerySystem gallery;
     
     // Command: add_photo
     if (command == "add_photo") {
         if (argc < 8) {
-            cerr << "Usage: " << argv[0] << " add_photo <filename> <location> <date> <description> <tags> <fileSize>" << endl;
+            err << "Usage: " << argv[0] << " add_photo <filename> <location> <date> <description> <tags> <fileSize>" << endl;
             return 1;
         }
         
@@ -1695,64 +4984,121 @@ int main(int argc, char* argv[]) {
         string dateStr = argv[4];
         string description = argv[5];
         string tagsStr = argv[6];
-        int fileSize = atoi(argv[7]);
+        int fileSize = atoi(argv[7].c_str());
         
         bool success = gallery.addPhoto(filename, location, dateStr, description, tagsStr, fileSize);
         
         if (success) {
-            cout << "success" << endl;
+            out << "success" << endl;
             return 0;
         } else {
-            cerr << "Failed to add photo" << endl;
+            err << "Failed to add photo" << endl;
+            return 1;
+        }
+    }
+    
+    // Command: import [file]
+    // Bulk add: one record per line, either NDJSON (photoToJson keys) or CSV
+    // (add_photo argument order, optional header line), read from file or,
+    // without one or with "-", from in. Bad lines are reported and skipped.
+    else if (command == "import") {
+        Clock::time_point start = Clock::now();
+        
+        ifstream file;
+        istream* input = &in;
+        if (argc >= 3 && argv[2] != "-") {
+            file.open(argv[2].c_str());
+            if (!file) {
+                err << "Cannot open " << argv[2] << endl;
+                return 1;
+            }
+            input = &file;
+        }
+        
+        vector<Photo> photos;
+        int skipped = 0;
+        string line;
+        for (int lineNumber = 1; getline(*input, line); lineNumber++) {
+            if (!line.empty() && line[line.length() - 1] == '\r') line.erase(line.length() - 1);
+            size_t first = line.find_first_not_of(" \t");
+            if (first == string::npos) continue;
+            
+            try {
+                if (line[first] == '{') {
+                    photos.push_back(photoFromJson(json::parse(line)));
+                } else {
+                    vector<string> fields = splitCsvLine(line);
+                    if (photos.empty() && skipped == 0 && fields[0] == "filename") continue;  // header
+                    photos.push_back(photoFromCsv(fields));
+                }
+            } catch (const exception& e) {
+                err << "Line " << lineNumber << ": " << e.what() << endl;
+                skipped++;
+            }
+        }
+        
+        int imported = gallery.importPhotos(photos);
+        if (imported == -1) {
+            err << "Failed to import photos" << endl;
             return 1;
         }
+        
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        json report;
+        report["imported"] = imported;
+        report["skipped"] = skipped + (int)photos.size() - imported;
+        report["seconds"] = seconds;
+        report["rowsPerSecond"] = seconds > 0 ? imported / seconds : 0.0;
+        out << report.dump() << endl;
+        return 0;
     }
     
-    // Command: get_all_photos
+    // Command: get_all_photos [offset] [limit]
+    // With an offset, only that page (to the end without a limit)
     else if (command == "get_all_photos") {
+        int offset = (argc > 2) ? atoi(argv[2].c_str()) : 0;
+        int limit = (argc > 3) ? atoi(argv[3].c_str()) : -1;
+        if (offset < 0) {
+            err << "Usage: " << argv[0] << " get_all_photos [offset] [limit]" << endl;
+            return 1;
+        }
+        
         // Create JSON array for all photos
         json photosJson = json::array();
         
-        // Get all photos
-        Photo* photos[1000];
-        gallery.getAllPhotos(photos);
+        // Get all photos, or one page of them
+        vector<Photo*> photos;
+        if (argc > 2) {
+            gallery.getPhotosPage(offset, limit, photos);
+        } else {
+            gallery.getAllPhotos(photos);
+        }
         
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
+        for (size_t i = 0; i < photos.size(); i++) {
             photosJson.push_back(photoToJson(*photos[i]));
         }
         
         // Output as JSON
-        cout << photosJson.dump() << endl;
+        out << photosJson.dump() << endl;
         return 0;
     }
     
     // Command: get_photo
     else if (command == "get_photo") {
         if (argc < 3) {
-            cerr << "Usage: " << argv[0] << " get_photo <id>" << endl;
+            err << "Usage: " << argv[0] << " get_photo <id>" << endl;
             return 1;
         }
         
-        int photoId = atoi(argv[2]);
-        Photo* photo = nullptr;
-        
-        // Find photo by ID
-        Photo* photos[1000];
-        gallery.getAllPhotos(photos);
-        
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
-            if (photos[i]->getId() == photoId) {
-                photo = photos[i];
-                break;
-            }
-        }
+        int photoId = atoi(argv[2].c_str());
+        Photo* photo = gallery.getPhotoById(photoId);
         
         if (photo) {
             // Output as JSON
-            cout << photoToJson(*photo).dump() << endl;
+            out << photoToJson(*photo).dump() << endl;
             return 0;
         } else {
-            cerr << "Photo not found" << endl;
+            err << "Photo not found" << endl;
             return 1;
         }
     }
@@ -1760,29 +5106,18 @@ int main(int argc, char* argv[]) {
     // Command: view_photo
     else if (command == "view_photo") {
         if (argc < 3) {
-            cerr << "Usage: " << argv[0] << " view_photo <id>" << endl;
+            err << "Usage: " << argv[0] << " view_photo <id>" << endl;
             return 1;
         }
         
-        int photoId = atoi(argv[2]);
-        bool success = false;
-        
-        // Find photo index by ID
-        Photo* photos[1000];
-        gallery.getAllPhotos(photos);
-        
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
-            if (photos[i]->getId() == photoId) {
-                success = gallery.viewPhoto(i);
-                break;
-            }
-        }
+        int photoId = atoi(argv[2].c_str());
+        bool success = gallery.viewPhoto(photoId);
         
         if (success) {
-            cout << "success" << endl;
+            out << "success" << endl;
             return 0;
         } else {
-            cerr << "Failed to view photo" << endl;
+            err << "Failed to view photo" << endl;
             return 1;
         }
     }
@@ -1790,29 +5125,18 @@ int main(int argc, char* argv[]) {
     // Command: delete_photo
     else if (command == "delete_photo") {
         if (argc < 3) {
-            cerr << "Usage: " << argv[0] << " delete_photo <id>" << endl;
+            err << "Usage: " << argv[0] << " delete_photo <id>" << endl;
             return 1;
         }
         
-        int photoId = atoi(argv[2]);
-        bool success = false;
-        
-        // Find photo index by ID
-        Photo* photos[1000];
-        gallery.getAllPhotos(photos);
-        
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
-            if (photos[i]->getId() == photoId) {
-                success = gallery.deletePhoto(i);
-                break;
-            }
-        }
+        int photoId = atoi(argv[2].c_str());
+        bool success = gallery.deletePhoto(photoId);
         
         if (success) {
-            cout << "success" << endl;
+            out << "success" << endl;
             return 0;
         } else {
-            cerr << "Failed to delete photo" << endl;
+            err << "Failed to delete photo" << endl;
             return 1;
         }
     }
@@ -1820,208 +5144,317 @@ int main(int argc, char* argv[]) {
     // Command: search
     else if (command == "search") {
         if (argc < 4) {
-            cerr << "Usage: " << argv[0] << " search <type> <term>" << endl;
+            err << "Usage: " << argv[0] << " search <type> <term>" << endl;
             return 1;
         }
         
-        string searchType = argv[2];
-        string searchTerm = argv[3];
-        
-        Photo* results[100];
-        int count = 0;
-        
-        if (searchType == "location") {
-            gallery.searchByLocation(searchTerm, results, count);
-        } else if (searchType == "tag") {
-            gallery.searchByTag(searchTerm, results, count);
-        } else if (searchType == "date_range") {
-            // Requires two dates separated by comma
-            size_t commaPos = searchTerm.find(',');
-            if (commaPos != string::npos) {
-                string startDate = searchTerm.substr(0, commaPos);
-                string endDate = searchTerm.substr(commaPos + 1);
-                gallery.searchByDateRange(startDate, endDate, results, count);
-            } else {
-                cerr << "Date range search requires start,end format" << endl;
-                return 1;
-            }
-        } else if (searchType == "description") {
-            gallery.searchByDescription(searchTerm, results, count);
-        } else if (searchType == "prefix") {
-            gallery.searchByPrefix(searchTerm, results, count);
-        } else {
-            cerr << "Unknown search type" << endl;
+        vector<Photo*> results;
+        if (!findPhotos(gallery, argv[2], argv[3], results, err)) {
             return 1;
         }
         
         // Create JSON array for search results
         json resultsJson = json::array();
         
-        for (int i = 0; i < count; i++) {
+        for (size_t i = 0; i < results.size(); i++) {
             resultsJson.push_back(photoToJson(*results[i]));
         }
         
         // Output as JSON
-        cout << resultsJson.dump() << endl;
+        out << resultsJson.dump() << endl;
         return 0;
     }
     
-    // Command: sort
+    // Command: sort <type> <ascending> [offset] [limit]
+    // With an offset, only that page of the order (to the end without a limit)
     else if (command == "sort") {
-        if (argc < 4) {
-            cerr << "Usage: " << argv[0] << " sort <type> <ascending>" << endl;
+        int offset = (argc > 4) ? atoi(argv[4].c_str()) : 0;
+        int limit = (argc > 5) ? atoi(argv[5].c_str()) : -1;
+        if (argc < 4 || offset < 0) {
+            err << "Usage: " << argv[0] << " sort <type> <ascending> [offset] [limit]" << endl;
             return 1;
         }
         
         string sortType = argv[2];
-        bool ascending = (string(argv[3]) == "true");
+        bool ascending = (argv[3] == "true");
         
-        Photo* results[1000];
+        vector<Photo*> results;
+        SortType type;
         
-        if (sortType == "date") {
+        if (!parseSortType(sortType, type)) {
+            err << "Unknown sort type" << endl;
+            return 1;
+        } else if (argc > 4) {
+            gallery.sortPhotosPage(type, !ascending, offset, limit, results);
+        } else if (sortType == "date") {
             gallery.sortByDate(results, !ascending);  // Note: sortByDate takes descending as param
         } else if (sortType == "size") {
             gallery.sortBySize(results, !ascending);  // Note: sortBySize takes descending as param
-        } else if (sortType == "popularity") {
-            gallery.sortByPopularity(results, !ascending);  // Note: sortByPopularity takes descending as param
         } else {
-            cerr << "Unknown sort type" << endl;
-            return 1;
+            gallery.sortByPopularity(results, !ascending);  // Note: sortByPopularity takes descending as param
         }
         
         // Create JSON array for sorted results
         json resultsJson = json::array();
         
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
+        for (size_t i = 0; i < results.size(); i++) {
             resultsJson.push_back(photoToJson(*results[i]));
         }
         
         // Output as JSON
-        cout << resultsJson.dump() << endl;
+        out << resultsJson.dump() << endl;
         return 0;
     }
     
+    // Command: stream [--after <cursor>] [--limit <n>] <listing>
+    // listing is get_all_photos, sort <type> <ascending> or search <type>
+    // <term>, written as NDJSON records with cursors (see STREAM_CHUNK)
+    else if (command == "stream") {
+        string after;
+        int limit = -1;
+        int next = 2;
+        while (next + 1 < argc && (argv[next] == "--after" || argv[next] == "--limit")) {
+            if (argv[next] == "--after") {
+                after = argv[next + 1];
+            } else {
+                limit = atoi(argv[next + 1].c_str());
+            }
+            next += 2;
+        }
+        
+        string listing = (next < argc) ? argv[next] : "";
+        long long first = 0, second = 0;
+        SortType sortType;
+        
+        if (listing == "get_all_photos") {
+            if (!after.empty() && !parseCursor(after, 'a', first, second)) {
+                err << "Invalid cursor: " << after << endl;
+                return 1;
+            }
+            int lastId = (int)min(max(first, 0LL), (long long)numeric_limits<int>::max());
+            streamPhotos(out, 0, limit, [&](int, int count, vector<Photo*>& photos) {
+                gallery.getPhotosAfter(lastId, count, photos);
+                if (!photos.empty()) lastId = photos.back()->getId();
+            }, [](const Photo& photo, int) {
+                return "a" + to_string(photo.getId());
+            });
+            return 0;
+        } else if (listing == "sort" && next + 2 < argc && parseSortType(argv[next + 1], sortType)) {
+            bool descending = (argv[next + 2] != "true");
+            if (!after.empty() && !parseCursor(after, 's', first, second)) {
+                err << "Invalid cursor: " << after << endl;
+                return 1;
+            }
+            int start = after.empty() ? 0 : gallery.sortPositionAfter(sortType, descending, first, second);
+            streamPhotos(out, start, limit, [&](int position, int count, vector<Photo*>& photos) {
+                gallery.sortPhotosPage(sortType, descending, position, count, photos);
+            }, [&](const Photo& photo, int) {
+                return "s" + to_string(sortKey(sortType, photo)) + ":" + to_string(photo.getId());
+            });
+            return 0;
+        } else if (listing == "search" && next + 2 < argc) {
+            if (!after.empty() && (!parseCursor(after, 'r', first, second) || first < 0)) {
+                err << "Invalid cursor: " << after << endl;
+                return 1;
+            }
+            // Searches are not paged: run it whole, then stream the results
+            vector<Photo*> results;
+            if (!findPhotos(gallery, argv[next + 1], argv[next + 2], results, err)) {
+                return 1;
+            }
+            streamPhotos(out, (int)min(first, (long long)results.size()), limit,
+                         [&](int position, int count, vector<Photo*>& photos) {
+                photos.assign(results.begin() + position, results.begin() + min(position + count, (int)results.size()));
+            }, [](const Photo&, int position) {
+                return "r" + to_string(position);
+            });
+            return 0;
+        }
+        
+        err << "Usage: " << argv[0] << " stream [--after <cursor>] [--limit <n>] "
+            << "get_all_photos | sort <type> <ascending> | search <type> <term>" << endl;
+        return 1;
+    }
+    
     // Command: add_tag
     else if (command == "add_tag") {
         if (argc < 4) {
-            cerr << "Usage: " << argv[0] << " add_tag <photo_id> <tag>" << endl;
+            err << "Usage: " << argv[0] << " add_tag <photo_id> <tag>" << endl;
             return 1;
         }
         
-        int photoId = atoi(argv[2]);
+        int photoId = atoi(argv[2].c_str());
         string tag = argv[3];
-        bool success = false;
-        
-        // Find photo index by ID
-        Photo* photos[1000];
-        gallery.getAllPhotos(photos);
-        
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
-            if (photos[i]->getId() == photoId) {
-                success = gallery.addTagToPhoto(i, tag);
-                break;
-            }
-        }
+        bool success = gallery.addTagToPhoto(photoId, tag);
         
         if (success) {
-            cout << "success" << endl;
+            out << "success" << endl;
             return 0;
         } else {
-            cerr << "Failed to add tag" << endl;
+            err << "Failed to add tag" << endl;
             return 1;
         }
     }
     
     // Command: get_most_recent
     else if (command == "get_most_recent") {
-        int limit = (argc > 2) ? atoi(argv[2]) : 5;
+        int limit = (argc > 2) ? atoi(argv[2].c_str()) : 5;
         
-        Photo* results[10];
-        int count;
+        vector<Photo*> results;
         
-        gallery.getMostRecentPhotos(results, count, limit);
+        gallery.getMostRecentPhotos(results, limit);
         
         // Create JSON array for recent photos
         json resultsJson = json::array();
         
-        for (int i = 0; i < count; i++) {
+        for (size_t i = 0; i < results.size(); i++) {
             resultsJson.push_back(photoToJson(*results[i]));
         }
         
         // Output as JSON
-        cout << resultsJson.dump() << endl;
+        out << resultsJson.dump() << endl;
         return 0;
     }
     
     // Command: get_most_popular
     else if (command == "get_most_popular") {
-        int limit = (argc > 2) ? atoi(argv[2]) : 5;
+        int limit = (argc > 2) ? atoi(argv[2].c_str()) : 5;
         
-        Photo* results[10];
-        int count;
+        vector<Photo*> results;
         
-        gallery.getMostPopularPhotos(results, count, limit);
+        gallery.getMostPopularPhotos(results, limit);
         
         // Create JSON array for popular photos
         json resultsJson = json::array();
         
-        for (int i = 0; i < count; i++) {
+        for (size_t i = 0; i < results.size(); i++) {
             resultsJson.push_back(photoToJson(*results[i]));
         }
         
         // Output as JSON
-        cout << resultsJson.dump() << endl;
+        out << resultsJson.dump() << endl;
         return 0;
     }
     
     // Command: update_photo
     else if (command == "update_photo") {
-        if (argc < 7) {
-            cerr << "Usage: " << argv[0] << " update_photo <id> <location> <description> <tags>" << endl;
+        if (argc < 6) {
+            err << "Usage: " << argv[0] << " update_photo <id> <location> <description> <tags>" << endl;
             return 1;
         }
         
-        int photoId = atoi(argv[2]);
+        int photoId = atoi(argv[2].c_str());
         string location = argv[3];
         string description = argv[4];
         string tags = argv[5];
         
-        bool success = false;
-        
-        // Find photo by ID
-        Photo* photos[1000];
-        gallery.getAllPhotos(photos);
-        
-        for (int i = 0; i < gallery.getPhotoCount(); i++) {
-            if (photos[i]->getId() == photoId) {
-                // Update photo properties
-                photos[i]->setLocation(location);
-                photos[i]->setDescription(description);
-                photos[i]->setTags(tags);
-                
-                // Update in DB
-                // (This would require adding an updatePhoto method to your PhotoGallerySystem class)
-                // success = gallery.updatePhoto(i);
-                
-                // For now, we'll just report success
-                success = true;
-                break;
-            }
-        }
+        bool success = gallery.updatePhoto(photoId, location, description, tags);
         
         if (success) {
-            cout << "success" << endl;
+            out << "success" << endl;
             return 0;
         } else {
-            cerr << "Failed to update photo" << endl;
+            err << "Failed to update photo" << endl;
             return 1;
         }
     }
     
     else {
-        cerr << "Unknown command: " << command << endl;
+        err << "Unknown command: " << command << endl;
         return 1;
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+// Serve mode: keep the gallery and all of its indexes resident and answer one
+// JSON request per line on stdin, writing one JSON response per line to stdout.
+//   request:  {"id": 1, "command": "search", "args": ["tag", "beach"]}
+//   response: {"id": 1, "status": 0, "output": "...", "error": ""}
+// "output" and "error" carry exactly what the one-shot command would have
+// printed, so callers can parse them the same way. The exception is stream:
+// its record and cursor lines go straight to stdout as they are written, so
+// the caller can use the first chunk while the rest is produced, and the
+// response line that follows them has an empty "output". Only the response
+// line has a "status". {"command": "quit"} or EOF ends the loop.
+int serve(PhotoGallerySystem& gallery, const string& programName) {
+    string line;
+    while (getline(cin, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+        
+        json response;
+        ostringstream out, err;
+        int status = 1;
+        
+        try {
+            json request = json::parse(line);
+            if (request.contains("id")) {
+                response["id"] = request["id"];
+            }
+            
+            string command = request.at("command").get<string>();
+            if (command == "quit") {
+                break;
+            }
+            
+            vector<string> args;
+            args.push_back(programName);
+            args.push_back(command);
+            if (request.contains("args")) {
+                for (const json& arg : request["args"]) {
+                    args.push_back(arg.is_string() ? arg.get<string>() : arg.dump());
+                }
+            }
+            
+            // stdin carries the requests, so import must be given a file
+            istringstream noInput;
+            if (command == "serve") {
+                err << "Already serving" << endl;
+            } else {
+                status = runCommand(gallery, args, command == "stream" ? cout : out, err, noInput);
+            }
+        } catch (const exception& e) {
+            err << "Bad request: " << e.what() << endl;
+            status = 1;
+        }
+        
+        response["status"] = status;
+        response["output"] = out.str();
+        response["error"] = err.str();
+        cout << response.dump(-1, ' ', false, json::error_handler_t::replace) << endl;
+    }
+    return 0;
+}
+
+// CLI entry point (photo_gallery_bench.cpp includes this file without it)
+#ifndef PHOTO_GALLERY_NO_MAIN
+int main(int argc, char* argv[]) {
+    // The database profile comes from --profile <name> ahead of the command,
+    // else from PHOTO_GALLERY_PROFILE, else the default
+    const char* envProfile = getenv("PHOTO_GALLERY_PROFILE");
+    string profileName = (envProfile != nullptr && *envProfile != '\0') ? envProfile : DEFAULT_DATABASE_PROFILE;
+    vector<string> args(argv, argv + argc);
+    if (args.size() >= 3 && args[1] == "--profile") {
+        profileName = args[2];
+        args.erase(args.begin() + 1, args.begin() + 3);
+    }
+    
+    if (args.size() < 2) {
+        cerr << "Usage: " << argv[0] << " [--profile safe|balanced|bulk-load] <command> [arguments...]" << endl;
+        cerr << "       " << argv[0] << " [--profile safe|balanced|bulk-load] serve" << endl;
+        return 1;
+    }
+    if (findDatabaseProfile(profileName) == nullptr) {
+        cerr << "Unknown database profile: " << profileName << endl;
+        return 1;
+    }
+    
+    PhotoGallerySystem gallery("photo_gallery.db", profileName);
+    
+    if (args[1] == "serve") {
+        return serve(gallery, argv[0]);
+    }
+    
+    return runCommand(gallery, args, cout, cerr);
+}
+#endif